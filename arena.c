@@ -0,0 +1,314 @@
+/* Copyright (C) 2016 Kirk Zurell.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/* guile-linux-key-retention: per-thread, locked, zeroing buffers for
+   key payloads.
+
+   Each thread keeps LKR_ARENA_SLOTS buffers. A buffer is mapped the
+   first time it is needed and only remapped when a larger payload
+   comes along, so steady-state calls do no allocation at all.
+*/
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "arena.h"
+
+/* Smallest mapping; also the size a read starts with. */
+#define LKR_ARENA_MIN_SIZE 4096
+
+struct lkr_arena
+{
+  struct lkr_buffer slot[LKR_ARENA_SLOTS];
+};
+
+static pthread_key_t arena_key;
+static pthread_once_t arena_once = PTHREAD_ONCE_INIT;
+
+
+
+/* ******************************************************************
+   Mappings
+*/
+
+void
+lkr_secure_zero(void *p, size_t len)
+{
+#ifdef HAVE_EXPLICIT_BZERO
+  explicit_bzero(p, len);
+#else
+  volatile unsigned char *v = p;
+
+  while(len--)
+    {
+      *v++ = 0;
+    }
+#endif
+}
+
+static size_t
+round_to_page(size_t len)
+{
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+
+  if(len < LKR_ARENA_MIN_SIZE)
+    {
+      len = LKR_ARENA_MIN_SIZE;
+    }
+
+  return (len + page - 1) & ~(page - 1);
+}
+
+static int
+buffer_map(struct lkr_buffer *buf, size_t len)
+{
+  size_t size = round_to_page(len);
+  void *data = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  if(data == MAP_FAILED)
+    {
+      return -1;
+    }
+
+  /* Both are best effort: RLIMIT_MEMLOCK may be too small to lock, and
+     zeroing on release still applies. */
+  mlock(data, size);
+#ifdef MADV_DONTDUMP
+  madvise(data, size, MADV_DONTDUMP);
+#endif
+
+  buf->data = data;
+  buf->size = size;
+  buf->used = 0;
+
+  return 0;
+}
+
+static void
+buffer_unmap(struct lkr_buffer *buf)
+{
+  if(buf->data)
+    {
+      lkr_secure_zero(buf->data, buf->used < buf->size ? buf->used : buf->size);
+      munlock(buf->data, buf->size);
+      munmap(buf->data, buf->size);
+    }
+
+  buf->data = NULL;
+  buf->size = 0;
+  buf->used = 0;
+}
+
+
+
+/* ******************************************************************
+   Per-thread arenas
+*/
+
+static void
+arena_destroy(void *p)
+{
+  struct lkr_arena *arena = p;
+  int i;
+
+  for(i = 0; i < LKR_ARENA_SLOTS; i++)
+    {
+      buffer_unmap(&arena->slot[i]);
+    }
+
+  free(arena);
+}
+
+static void
+arena_init(void)
+{
+  pthread_key_create(&arena_key, arena_destroy);
+}
+
+static struct lkr_arena *
+arena_get(void)
+{
+  struct lkr_arena *arena;
+
+  pthread_once(&arena_once, arena_init);
+
+  arena = pthread_getspecific(arena_key);
+
+  if(arena == NULL)
+    {
+      arena = calloc(1, sizeof(*arena));
+
+      if(arena != NULL)
+	{
+	  pthread_setspecific(arena_key, arena);
+	}
+    }
+
+  return arena;
+}
+
+struct lkr_buffer *
+lkr_arena_acquire(size_t len)
+{
+  struct lkr_arena *arena = arena_get();
+  struct lkr_buffer *buf = NULL;
+  int i;
+
+  if(arena != NULL)
+    {
+      /* Prefer a free slot that is already big enough. */
+      for(i = 0; i < LKR_ARENA_SLOTS; i++)
+	{
+	  struct lkr_buffer *slot = &arena->slot[i];
+
+	  if(!slot->busy
+	     && (buf == NULL || (buf->size < len && slot->size > buf->size)))
+	    {
+	      buf = slot;
+	    }
+	}
+    }
+
+  if(buf == NULL)
+    {
+      /* Every slot is in use: fall back to a one-off buffer. */
+      buf = calloc(1, sizeof(*buf));
+
+      if(buf == NULL)
+	{
+	  return NULL;
+	}
+
+      buf->transient = 1;
+    }
+
+  if((buf->data == NULL || buf->size < len) && lkr_arena_grow(buf, len) < 0)
+    {
+      if(buf->transient)
+	{
+	  free(buf);
+	}
+
+      return NULL;
+    }
+
+  buf->busy = 1;
+  buf->used = len;
+
+  return buf;
+}
+
+struct lkr_buffer *
+lkr_buffer_alloc(size_t len)
+{
+  struct lkr_buffer *buf = calloc(1, sizeof(*buf));
+
+  if(buf == NULL)
+    {
+      return NULL;
+    }
+
+  buf->transient = 1;
+
+  if(buffer_map(buf, len) < 0)
+    {
+      free(buf);
+      return NULL;
+    }
+
+  buf->busy = 1;
+  buf->used = len;
+
+  return buf;
+}
+
+int
+lkr_arena_grow(struct lkr_buffer *buf, size_t len)
+{
+  if(buf->data != NULL && buf->size >= len)
+    {
+      buf->used = len;
+      return 0;
+    }
+
+  buffer_unmap(buf);
+
+  if(buffer_map(buf, len) < 0)
+    {
+      return -1;
+    }
+
+  buf->used = len;
+
+  return 0;
+}
+
+int
+lkr_arena_extend(struct lkr_buffer *buf, size_t len, size_t keep)
+{
+  struct lkr_buffer larger = { 0 };
+
+  if(buf->data != NULL && buf->size >= len)
+    {
+      return 0;
+    }
+
+  if(buffer_map(&larger, len) < 0)
+    {
+      return -1;
+    }
+
+  if(keep)
+    {
+      memcpy(larger.data, buf->data, keep);
+    }
+
+  /* Zero everything the old mapping may hold. */
+  if(buf->used < keep)
+    {
+      buf->used = keep;
+    }
+
+  buffer_unmap(buf);
+
+  buf->data = larger.data;
+  buf->size = larger.size;
+  buf->used = keep;
+
+  return 0;
+}
+
+void
+lkr_arena_release(struct lkr_buffer *buf)
+{
+  if(buf->transient)
+    {
+      buffer_unmap(buf);
+      free(buf);
+      return;
+    }
+
+  lkr_secure_zero(buf->data, buf->used < buf->size ? buf->used : buf->size);
+
+  buf->used = 0;
+  buf->busy = 0;
+}
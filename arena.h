@@ -0,0 +1,69 @@
+/* Copyright (C) 2016 Kirk Zurell.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/* guile-linux-key-retention: staging buffers for key payloads. */
+
+#ifndef GUILE_LKR_ARENA_H
+#define GUILE_LKR_ARENA_H
+
+#include <stddef.h>
+
+/* Number of buffers kept per thread. A wrapper needs at most one at a
+   time; the rest cover nested use. */
+#define LKR_ARENA_SLOTS 4
+
+/* A payload staging buffer.
+
+   The memory is mapped privately, locked against swapping where
+   RLIMIT_MEMLOCK permits, and excluded from core dumps. It belongs to
+   the thread that acquired it, and is zeroed when released so that
+   secrets do not outlive the call that used them.
+*/
+struct lkr_buffer
+{
+  char *data;
+  size_t size;   /* Bytes mapped. */
+  size_t used;   /* Bytes to zero on release. Callers may lower it. */
+  int busy;
+  int transient; /* Not one of the thread's slots; unmapped on release. */
+};
+
+/* Returns a buffer of at least len bytes, or NULL if no memory could
+   be mapped. Steady-state calls reuse an existing mapping. */
+struct lkr_buffer *lkr_arena_acquire(size_t len);
+
+/* Returns a buffer of at least len bytes that belongs to no thread,
+   for a payload handed from one thread to another. It may be released
+   by any thread. Returns NULL if no memory could be mapped. */
+struct lkr_buffer *lkr_buffer_alloc(size_t len);
+
+/* Grows buf to hold at least len bytes. The contents are NOT
+   preserved. Returns 0, or -1 if no memory could be mapped. */
+int lkr_arena_grow(struct lkr_buffer *buf, size_t len);
+
+/* Grows buf to hold at least len bytes, keeping its first keep bytes.
+   Returns 0, or -1 if no memory could be mapped. */
+int lkr_arena_extend(struct lkr_buffer *buf, size_t len, size_t keep);
+
+/* Zeroes the used part of buf and returns it to its thread. */
+void lkr_arena_release(struct lkr_buffer *buf);
+
+/* Zeroes len bytes at p in a way the compiler will not elide. */
+void lkr_secure_zero(void *p, size_t len);
+
+#endif /* GUILE_LKR_ARENA_H */
@@ -0,0 +1,961 @@
+/* Copyright (C) 2016 Kirk Zurell.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/* guile-linux-key-retention: key calls run on worker threads.
+
+   A key job makes one request_key, KEYCTL_SEARCH or KEYCTL_READ call
+   on a worker thread (see pool.c). When the call returns, the job's
+   id is written to the completion pipe. An event loop, such as a
+   Fibers scheduler, waits for the pipe's read end to become readable,
+   reaps the ids, and collects each finished job's result; see
+   (linux-key-retention fibers).
+
+   The job is shared by the worker and the Scheme object, and freed
+   when both are done with it. Special key ids name the keyrings of
+   the thread that uses them, so they are resolved to serials before
+   the job is submitted.
+
+   keyctl-search-any searches an ordered list of keyrings at once: the
+   calling thread searches the first itself, and workers of their own,
+   which never wait behind a key job's upcall, search the rest. It
+   returns as soon as the earliest keyring to hold the key is known;
+   searches still queued by then are skipped, and those under way are
+   left to finish unheeded.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <libguile.h>
+
+#include <keyutils.h>
+
+#include "arena.h"
+#include "async.h"
+#include "convert.h"
+#include "keyhandle.h"
+#include "pool.h"
+#include "stats.h"
+
+#define KEY_JOB_DESC "KEY-JOB"
+#define KEY_SERIAL_LIST_DESC "list of " KEY_SERIAL_DESC
+
+enum key_job_op
+  {
+    KEY_JOB_REQUEST_KEY,
+    KEY_JOB_SEARCH,
+    KEY_JOB_READ
+  };
+
+struct lkr_key_job
+{
+  struct lkr_job job;
+  enum key_job_op op;
+  uint64_t id;
+
+  /* Arguments. The strings are staged in strings, which is zeroed
+     when the job is freed. */
+  struct lkr_buffer *strings;
+  const char *type;
+  const char *description;
+  const char *callout_info;
+  key_serial_t key;      /* Key to read, or keyring to search. */
+  key_serial_t dest_keyring;
+
+  /* Results, valid once done is set. The payload is released as soon
+     as key-job-result has converted it. */
+  long result;
+  int error;
+  struct lkr_buffer *payload;
+  int done;
+
+  int refs;
+};
+
+static scm_t_bits key_job_tag;
+
+static uint64_t next_job_id;
+
+static int completion_pipe[2] = { -1, -1 };
+static pthread_once_t completion_once = PTHREAD_ONCE_INIT;
+static int completion_error;
+
+/* Set when a full pipe dropped an id; see key_job_done. */
+static int completion_overflow;
+
+#define KEY_JOB(x) ((struct lkr_key_job *)SCM_SMOB_DATA(x))
+
+
+
+/* ******************************************************************
+   Jobs
+*/
+
+static void
+key_job_unref(struct lkr_key_job *kj)
+{
+  if(__atomic_sub_fetch(&kj->refs, 1, __ATOMIC_ACQ_REL) > 0)
+    {
+      return;
+    }
+
+  if(kj->payload)
+    {
+      lkr_arena_release(kj->payload);
+    }
+
+  if(kj->strings)
+    {
+      lkr_arena_release(kj->strings);
+    }
+
+  free(kj);
+}
+
+static void
+open_completion_pipe(void)
+{
+  int i;
+
+  if(pipe(completion_pipe) < 0)
+    {
+      completion_error = errno;
+      return;
+    }
+
+  for(i = 0; i < 2; i++)
+    {
+      if(fcntl(completion_pipe[i], F_SETFL, O_NONBLOCK) < 0
+	 || fcntl(completion_pipe[i], F_SETFD, FD_CLOEXEC) < 0)
+	{
+	  completion_error = errno;
+	}
+    }
+}
+
+/* Returns the read end of the completion pipe, or -1 with errno set. */
+static int
+completion_fd(void)
+{
+  pthread_once(&completion_once, open_completion_pipe);
+
+  if(completion_error)
+    {
+      errno = completion_error;
+      return -1;
+    }
+
+  return completion_pipe[0];
+}
+
+static void
+run_key_job(struct lkr_job *job)
+{
+  struct lkr_key_job *kj = (struct lkr_key_job *)job;
+  long long start = 0;
+
+  switch(kj->op)
+    {
+    case KEY_JOB_REQUEST_KEY:
+      start = lkr_stat_now_ns();
+      kj->result = lkr_stat(LKR_STAT_REQUEST_KEY,
+			    request_key(kj->type, kj->description,
+					kj->callout_info, kj->dest_keyring));
+      lkr_stat_request_key_ns(lkr_stat_now_ns() - start);
+      break;
+
+    case KEY_JOB_SEARCH:
+      kj->result = lkr_stat(LKR_STAT_SEARCH,
+			    keyctl(KEYCTL_SEARCH, kj->key, kj->type,
+				   kj->description, kj->dest_keyring));
+      break;
+
+    case KEY_JOB_READ:
+      /* The payload outlives this thread's part in the job, so it is
+	 staged in a buffer of its own rather than in the thread's. */
+      if((kj->payload = lkr_buffer_alloc(0)) == NULL)
+	{
+	  kj->result = -1;
+	  errno = ENOMEM;
+	  break;
+	}
+
+      for(;;)
+	{
+	  kj->result = keyctl(KEYCTL_READ, kj->key, kj->payload->data,
+			      kj->payload->size);
+
+	  if(kj->result < 0 || (size_t)kj->result <= kj->payload->size)
+	    {
+	      break;
+	    }
+
+	  if(lkr_arena_grow(kj->payload, kj->result) < 0)
+	    {
+	      kj->result = -1;
+	      errno = ENOMEM;
+	      break;
+	    }
+	}
+
+      lkr_stat(LKR_STAT_READ, kj->result);
+      kj->payload->used = kj->result < 0 ? 0 : kj->result;
+      break;
+    }
+
+  kj->error = kj->result < 0 ? errno : 0;
+}
+
+static ssize_t
+write_completion(uint64_t id)
+{
+  ssize_t result = 0;
+
+  while((result = write(completion_pipe[1], &id, sizeof(id))) < 0 && errno == EINTR)
+    {
+      ;
+    }
+
+  return result;
+}
+
+static void
+key_job_done(struct lkr_job *job)
+{
+  struct lkr_key_job *kj = (struct lkr_key_job *)job;
+  uint64_t id = kj->id;
+
+  __atomic_store_n(&kj->done, 1, __ATOMIC_RELEASE);
+
+  /* A full pipe drops the id rather than stall the worker, and says so
+     with completion_overflow, so that whoever reaps next checks every
+     job it waits on. The flag is set before trying once more: either
+     that write lands, or the pipe is full again, and the reaper wakes
+     up after the flag is set either way. */
+  if(write_completion(id) < 0 && errno == EAGAIN)
+    {
+      __atomic_store_n(&completion_overflow, 1, __ATOMIC_RELEASE);
+      write_completion(id);
+    }
+
+  key_job_unref(kj);
+}
+
+/* Allocates a job for op, owned by the returned Scheme object. */
+static SCM
+make_key_job(enum key_job_op op, struct lkr_key_job **pkj)
+{
+  struct lkr_key_job *kj = calloc(1, sizeof(*kj));
+  SCM job;
+
+  if(kj == NULL)
+    {
+      scm_report_out_of_memory();
+    }
+
+  kj->job.run = run_key_job;
+  kj->job.done = key_job_done;
+  kj->op = op;
+  kj->id = __atomic_add_fetch(&next_job_id, 1, __ATOMIC_RELAXED);
+  kj->refs = 1;
+
+  SCM_NEWSMOB(job, key_job_tag, kj);
+
+  *pkj = kj;
+
+  return job;
+}
+
+/* Returns the serial a special key id, such as
+   KEY_SPEC_THREAD_KEYRING, names for the calling thread, creating the
+   keyring if create is set, or -1 with errno set. Other ids are
+   returned as they are. */
+static long
+get_key_serial(key_serial_t id, int create)
+{
+  if(id >= 0)
+    {
+      return id;
+    }
+
+  return lkr_stat(LKR_STAT_GET_KEYRING_ID,
+		  keyctl(KEYCTL_GET_KEYRING_ID, id, create));
+}
+
+static void
+release_lkr_buffer(void *buf)
+{
+  lkr_arena_release(buf);
+}
+
+/* Stages the n strings in strs, skipping any that are not strings, in
+   a buffer of its own that any thread may release, and stores their
+   offsets in offsets. */
+static struct lkr_buffer *
+stage_job_strings(const SCM *strs, size_t *offsets, size_t n, const char *subr)
+{
+  struct lkr_buffer *buf = lkr_buffer_alloc(0);
+  size_t pos = 0;
+  size_t i;
+
+  if(buf == NULL)
+    {
+      scm_report_out_of_memory();
+    }
+
+  scm_dynwind_begin(0);
+  scm_dynwind_unwind_handler(release_lkr_buffer, buf, 0);
+
+  for(i = 0; i < n; i++)
+    {
+      if(scm_is_string(strs[i]))
+	{
+	  offsets[i] = lkr_stage_string(buf, &pos, strs[i], 1, subr);
+	}
+    }
+
+  scm_dynwind_end();
+
+  return buf;
+}
+
+static key_serial_t
+resolve_key_serial(key_serial_t id, int create, const char *subr)
+{
+  long result = get_key_serial(id, create);
+
+  if(result < 0)
+    {
+      scm_syserror(subr);
+    }
+
+  return result;
+}
+
+static SCM
+submit_key_job(SCM job, const char *subr)
+{
+  struct lkr_key_job *kj = KEY_JOB(job);
+
+  if(completion_fd() < 0)
+    {
+      scm_syserror(subr);
+    }
+
+  /* The worker's reference. */
+  __atomic_add_fetch(&kj->refs, 1, __ATOMIC_RELAXED);
+
+  if(lkr_pool_submit(LKR_POOL_KEY_JOBS, &kj->job) < 0)
+    {
+      int error = errno;
+
+      key_job_unref(kj);
+      errno = error;
+      scm_syserror(subr);
+    }
+
+  return job;
+}
+
+static size_t
+free_key_job(SCM job)
+{
+  key_job_unref(KEY_JOB(job));
+
+  return 0;
+}
+
+static int
+print_key_job(SCM job, SCM port, scm_print_state *pstate)
+{
+  struct lkr_key_job *kj = KEY_JOB(job);
+
+  scm_puts("#<key-job ", port);
+  scm_intprint(kj->id, 10, port);
+
+  if(__atomic_load_n(&kj->done, __ATOMIC_ACQUIRE))
+    {
+      scm_puts(" done", port);
+    }
+
+  scm_puts(">", port);
+
+  return 1;
+}
+
+
+
+/* ******************************************************************
+   Searching several keyrings
+*/
+
+struct search_tier
+{
+  struct lkr_job job;
+  struct search_any *sa;
+  long result;   /* The key found, or -1. */
+  int finished;
+  int queued;    /* Whether a worker took it. */
+};
+
+/* Shared by the caller and the workers searching its tiers, and freed
+   by whichever is done with it last. */
+struct search_any
+{
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+
+  struct lkr_buffer *strings;
+  const char *type;
+  const char *description;
+  key_serial_t *keyrings;
+
+  size_t n;
+  struct search_tier *tiers;
+
+  int abandoned;
+  int refs;
+};
+
+static void
+search_any_unref(struct search_any *sa)
+{
+  if(__atomic_sub_fetch(&sa->refs, 1, __ATOMIC_ACQ_REL) > 0)
+    {
+      return;
+    }
+
+  pthread_mutex_destroy(&sa->lock);
+  pthread_cond_destroy(&sa->cond);
+  if(sa->strings)
+    {
+      lkr_arena_release(sa->strings);
+    }
+
+  free(sa->keyrings);
+  free(sa->tiers);
+  free(sa);
+}
+
+static void
+unref_search_any(void *sa)
+{
+  search_any_unref(sa);
+}
+
+static long
+search_tier(struct search_any *sa, size_t i)
+{
+  long result = keyctl(KEYCTL_SEARCH, sa->keyrings[i], sa->type,
+		       sa->description, 0);
+
+  /* Whatever the reason, a failed tier is a miss. */
+  return result > 0 ? result : -1;
+}
+
+static void
+finish_tier(struct search_any *sa, size_t i, long result)
+{
+  pthread_mutex_lock(&sa->lock);
+  sa->tiers[i].result = result;
+  sa->tiers[i].finished = 1;
+  pthread_cond_signal(&sa->cond);
+  pthread_mutex_unlock(&sa->lock);
+}
+
+static void
+run_search_tier(struct lkr_job *job)
+{
+  struct search_tier *tier = (struct search_tier *)job;
+  struct search_any *sa = tier->sa;
+  size_t i = tier - sa->tiers;
+
+  finish_tier(sa, i, __atomic_load_n(&sa->abandoned, __ATOMIC_ACQUIRE)
+	      ? -1 : search_tier(sa, i));
+}
+
+static void
+search_tier_done(struct lkr_job *job)
+{
+  search_any_unref(((struct search_tier *)job)->sa);
+}
+
+/* Waits, outside Guile mode, for the earliest tier to hit, or for
+   every tier to miss. Returns the key found, or -1. */
+static void *
+wait_search_any(void *p)
+{
+  struct search_any *sa = p;
+  long result = -1;
+  size_t i;
+
+  pthread_mutex_lock(&sa->lock);
+
+  for(;;)
+    {
+      for(i = 0; i < sa->n && sa->tiers[i].finished && sa->tiers[i].result < 0; i++)
+	;
+
+      if(i == sa->n)
+	{
+	  break;
+	}
+
+      if(sa->tiers[i].finished)
+	{
+	  result = sa->tiers[i].result;
+	  break;
+	}
+
+      pthread_cond_wait(&sa->cond, &sa->lock);
+    }
+
+  __atomic_store_n(&sa->abandoned, 1, __ATOMIC_RELEASE);
+
+  pthread_mutex_unlock(&sa->lock);
+
+  return (void *)result;
+}
+
+
+
+/* ******************************************************************
+   Methods
+*/
+
+SCM_DEFINE (key_job_submit_request_key,   /* Function name in C */
+            "key-job-submit-request-key", /* Function name in Scheme */
+            2, 2,      /* No. of required/optional args */
+            0,         /* Whether accepts "rest" arg */
+            (SCM keytype, SCM description, SCM callout_info, SCM dest_keyring), /* C argument list */
+            "Start a request-key on a worker thread.") /* Docstring */
+{
+  struct lkr_key_job *kj = NULL;
+  key_serial_t dest = 0;
+  SCM job;
+
+  SCM_ASSERT_TYPE(scm_is_string(keytype), keytype, SCM_ARG1, s_key_job_submit_request_key, STRING_DESC);
+  SCM_ASSERT_TYPE(scm_is_string(description), description, SCM_ARG2, s_key_job_submit_request_key, STRING_DESC);
+  SCM_ASSERT_TYPE(scm_is_string(callout_info)
+		  || scm_is_false(callout_info)
+		  || scm_is_undefined(callout_info),
+		  callout_info, SCM_ARG3, s_key_job_submit_request_key, STRING_DESC OR_FALSE);
+  SCM_ASSERT_TYPE(scm_is_key_serial_t(dest_keyring)
+		  || scm_is_false(dest_keyring)
+		  || scm_is_undefined(dest_keyring),
+		  dest_keyring, SCM_ARG4, s_key_job_submit_request_key, KEY_SERIAL_DESC OR_FALSE);
+
+  /* request_key would create a special destination keyring. */
+  if(scm_is_key_serial_t(dest_keyring))
+    {
+      dest = resolve_key_serial(scm_to_key_serial_t(dest_keyring), 1,
+				s_key_job_submit_request_key);
+    }
+
+  job = make_key_job(KEY_JOB_REQUEST_KEY, &kj);
+
+  {
+    const SCM strs[] = { keytype, description, callout_info };
+    size_t offsets[3];
+
+    kj->strings = stage_job_strings(strs, offsets, 3, s_key_job_submit_request_key);
+    kj->type = kj->strings->data + offsets[0];
+    kj->description = kj->strings->data + offsets[1];
+    kj->callout_info = scm_is_string(callout_info) ? kj->strings->data + offsets[2] : NULL;
+  }
+
+  kj->dest_keyring = dest;
+
+  return submit_key_job(job, s_key_job_submit_request_key);
+}
+
+
+SCM_DEFINE (key_job_submit_search,   /* Function name in C */
+            "key-job-submit-search", /* Function name in Scheme */
+            3, 1,      /* No. of required/optional args */
+            0,         /* Whether accepts "rest" arg */
+            (SCM keyring, SCM keytype, SCM description, SCM dest_keyring), /* C argument list */
+            "Start a keyctl-search on a worker thread.") /* Docstring */
+{
+  struct lkr_key_job *kj = NULL;
+  key_serial_t ring = 0;
+  key_serial_t dest = 0;
+  SCM job;
+
+  SCM_ASSERT_TYPE(scm_is_key_serial_t(keyring), keyring, SCM_ARG1, s_key_job_submit_search, KEY_SERIAL_DESC);
+  SCM_ASSERT_TYPE(scm_is_string(keytype), keytype, SCM_ARG2, s_key_job_submit_search, STRING_DESC);
+  SCM_ASSERT_TYPE(scm_is_string(description), description, SCM_ARG3, s_key_job_submit_search, STRING_DESC);
+  SCM_ASSERT_TYPE(scm_is_key_serial_t(dest_keyring)
+		  || scm_is_false(dest_keyring)
+		  || scm_is_undefined(dest_keyring),
+		  dest_keyring, SCM_ARG4, s_key_job_submit_search, KEY_SERIAL_DESC OR_FALSE);
+
+  ring = resolve_key_serial(scm_to_key_serial_t(keyring), 0, s_key_job_submit_search);
+
+  if(scm_is_key_serial_t(dest_keyring))
+    {
+      dest = resolve_key_serial(scm_to_key_serial_t(dest_keyring), 1,
+				s_key_job_submit_search);
+    }
+
+  job = make_key_job(KEY_JOB_SEARCH, &kj);
+
+  {
+    const SCM strs[] = { keytype, description };
+    size_t offsets[2];
+
+    kj->strings = stage_job_strings(strs, offsets, 2, s_key_job_submit_search);
+    kj->type = kj->strings->data + offsets[0];
+    kj->description = kj->strings->data + offsets[1];
+  }
+
+  kj->key = ring;
+  kj->dest_keyring = dest;
+
+  return submit_key_job(job, s_key_job_submit_search);
+}
+
+
+SCM_DEFINE (key_job_submit_read,   /* Function name in C */
+            "key-job-submit-read", /* Function name in Scheme */
+            1, 0,      /* No. of required/optional args */
+            0,         /* Whether accepts "rest" arg */
+            (SCM key), /* C argument list */
+            "Start a keyctl-read on a worker thread.") /* Docstring */
+{
+  struct lkr_key_job *kj = NULL;
+  key_serial_t serial = 0;
+  SCM job;
+
+  SCM_ASSERT_TYPE(scm_is_key_serial_t(key), key, SCM_ARG1, s_key_job_submit_read, KEY_SERIAL_DESC);
+
+  serial = resolve_key_serial(scm_to_key_serial_t(key), 0, s_key_job_submit_read);
+
+  job = make_key_job(KEY_JOB_READ, &kj);
+
+  kj->key = serial;
+
+  return submit_key_job(job, s_key_job_submit_read);
+}
+
+
+SCM_DEFINE (key_job_completion_fd,   /* Function name in C */
+            "key-job-completion-fd", /* Function name in Scheme */
+            0, 0,      /* No. of required/optional args */
+            0,         /* Whether accepts "rest" arg */
+            (void), /* C argument list */
+            "The file descriptor that becomes readable when a key job finishes.") /* Docstring */
+{
+  int fd = completion_fd();
+
+  if(fd < 0)
+    {
+      scm_syserror(s_key_job_completion_fd);
+    }
+
+  return scm_from_int(fd);
+}
+
+
+SCM_DEFINE (key_job_reap,   /* Function name in C */
+            "key-job-reap", /* Function name in Scheme */
+            0, 0,      /* No. of required/optional args */
+            0,         /* Whether accepts "rest" arg */
+            (void), /* C argument list */
+            "Drain the completion descriptor. Returns the ids of the jobs that finished since the last call.") /* Docstring */
+{
+  uint64_t ids[64];
+  SCM reaped = SCM_EOL;
+  ssize_t result = 0;
+  int fd = completion_fd();
+  size_t i;
+
+  if(fd < 0)
+    {
+      scm_syserror(s_key_job_reap);
+    }
+
+  /* Ids are written whole, and pipe writes this small are atomic, so
+     reads never split one. */
+  for(;;)
+    {
+      result = read(fd, ids, sizeof(ids));
+
+      if(result < 0 && errno == EINTR)
+	{
+	  continue;
+	}
+
+      if(result <= 0)
+	{
+	  break;
+	}
+
+      for(i = 0; i < (size_t)result / sizeof(ids[0]); i++)
+	{
+	  reaped = scm_cons(scm_from_uint64(ids[i]), reaped);
+	}
+    }
+
+  if(result < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+    {
+      scm_syserror(s_key_job_reap);
+    }
+
+  return scm_reverse_x(reaped, SCM_EOL);
+}
+
+
+SCM_DEFINE (key_job_overflow_p,   /* Function name in C */
+            "key-job-overflow?", /* Function name in Scheme */
+            0, 0,      /* No. of required/optional args */
+            0,         /* Whether accepts "rest" arg */
+            (void), /* C argument list */
+            "Whether the completion descriptor was too full to take some ids since the last call. If so, key-job-reap did not return them, and any job waited on may have finished.") /* Docstring */
+{
+  return scm_from_bool(__atomic_exchange_n(&completion_overflow, 0, __ATOMIC_ACQ_REL));
+}
+
+
+SCM_DEFINE (key_job_id,   /* Function name in C */
+            "key-job-id", /* Function name in Scheme */
+            1, 0,      /* No. of required/optional args */
+            0,         /* Whether accepts "rest" arg */
+            (SCM job), /* C argument list */
+            "The id key-job-reap reports @var{job} by.") /* Docstring */
+{
+  SCM_ASSERT_TYPE(SCM_SMOB_PREDICATE(key_job_tag, job), job, SCM_ARG1, s_key_job_id, KEY_JOB_DESC);
+
+  return scm_from_uint64(KEY_JOB(job)->id);
+}
+
+
+SCM_DEFINE (key_job_done_p,   /* Function name in C */
+            "key-job-done?", /* Function name in Scheme */
+            1, 0,      /* No. of required/optional args */
+            0,         /* Whether accepts "rest" arg */
+            (SCM job), /* C argument list */
+            "Whether @var{job} has finished.") /* Docstring */
+{
+  SCM_ASSERT_TYPE(SCM_SMOB_PREDICATE(key_job_tag, job), job, SCM_ARG1, s_key_job_done_p, KEY_JOB_DESC);
+
+  return scm_from_bool(__atomic_load_n(&KEY_JOB(job)->done, __ATOMIC_ACQUIRE));
+}
+
+
+SCM_DEFINE (key_job_result,   /* Function name in C */
+            "key-job-result", /* Function name in Scheme */
+            1, 0,      /* No. of required/optional args */
+            0,         /* Whether accepts "rest" arg */
+            (SCM job), /* C argument list */
+            "The result of the finished @var{job}, as the blocking procedure would have returned it. A read job's payload is zeroed once it is returned, so it can be collected only once.") /* Docstring */
+{
+  struct lkr_key_job *kj = NULL;
+  SCM value = SCM_BOOL_F;
+
+  SCM_ASSERT_TYPE(SCM_SMOB_PREDICATE(key_job_tag, job), job, SCM_ARG1, s_key_job_result, KEY_JOB_DESC);
+
+  kj = KEY_JOB(job);
+
+  if(!__atomic_load_n(&kj->done, __ATOMIC_ACQUIRE))
+    {
+      scm_misc_error(s_key_job_result, "Key job ~A has not finished",
+		     scm_list_1(scm_from_uint64(kj->id)));
+    }
+
+  if(kj->result < 0)
+    {
+      errno = kj->error;
+      scm_syserror(s_key_job_result);
+    }
+
+  switch(kj->op)
+    {
+    case KEY_JOB_REQUEST_KEY:
+      value = scm_from_key_serial_t(kj->result);
+      break;
+
+    case KEY_JOB_SEARCH:
+      value = kj->result ? scm_from_key_serial_t(kj->result) : SCM_BOOL_T;
+      break;
+
+    case KEY_JOB_READ:
+      {
+	/* Taken, so that the secret is zeroed now rather than when the
+	   job is collected, and is collected once. */
+	struct lkr_buffer *payload = __atomic_exchange_n(&kj->payload, NULL,
+							 __ATOMIC_ACQ_REL);
+
+	if(payload == NULL)
+	  {
+	    scm_misc_error(s_key_job_result, "Key job ~A's payload was already collected",
+			   scm_list_1(scm_from_uint64(kj->id)));
+	  }
+
+	scm_dynwind_begin(0);
+	scm_dynwind_unwind_handler(release_lkr_buffer, payload, SCM_F_WIND_EXPLICITLY);
+
+	if(kj->result)
+	  {
+	    value = scm_from_locale_stringn(payload->data, kj->result);
+	  }
+
+	scm_dynwind_end();
+      }
+      break;
+    }
+
+  scm_remember_upto_here_1(job);
+
+  return value;
+}
+
+
+SCM_DEFINE (keyctl_search_any,   /* Function name in C */
+            "keyctl-search-any", /* Function name in Scheme */
+            3, 0,      /* No. of required/optional args */
+            0,         /* Whether accepts "rest" arg */
+            (SCM keyrings, SCM keytype, SCM description), /* C argument list */
+            "Search each of the list @var{keyrings} at once. Returns the key found in the earliest keyring that holds one, or #f.") /* Docstring */
+{
+  struct search_any *sa = NULL;
+  long result = -1;
+  long len = scm_ilength(keyrings);
+  size_t i;
+  SCM rest;
+
+  SCM_ASSERT_TYPE(len >= 0, keyrings, SCM_ARG1, s_keyctl_search_any, KEY_SERIAL_LIST_DESC);
+  SCM_ASSERT_TYPE(scm_is_string(keytype), keytype, SCM_ARG2, s_keyctl_search_any, STRING_DESC);
+  SCM_ASSERT_TYPE(scm_is_string(description), description, SCM_ARG3, s_keyctl_search_any, STRING_DESC);
+
+  for(rest = keyrings; !scm_is_null(rest); rest = scm_cdr(rest))
+    {
+      SCM_ASSERT_TYPE(scm_is_key_serial_t(scm_car(rest)), keyrings, SCM_ARG1,
+		      s_keyctl_search_any, KEY_SERIAL_LIST_DESC);
+    }
+
+  if(len == 0)
+    {
+      lkr_stat(LKR_STAT_SEARCH_ANY, -1);
+      return SCM_BOOL_F;
+    }
+
+  if((sa = calloc(1, sizeof(*sa))) == NULL)
+    {
+      scm_report_out_of_memory();
+    }
+
+  pthread_mutex_init(&sa->lock, NULL);
+  pthread_cond_init(&sa->cond, NULL);
+  sa->n = len;
+  sa->refs = 1;
+
+  scm_dynwind_begin(0);
+  scm_dynwind_unwind_handler(unref_search_any, sa, 0);
+
+  sa->keyrings = calloc(len, sizeof(*sa->keyrings));
+  sa->tiers = calloc(len, sizeof(*sa->tiers));
+
+  if(sa->keyrings == NULL || sa->tiers == NULL)
+    {
+      scm_report_out_of_memory();
+    }
+
+  for(i = 0, rest = keyrings; i < sa->n; i++, rest = scm_cdr(rest))
+    {
+      sa->keyrings[i] = scm_to_key_serial_t(scm_car(rest));
+    }
+
+  {
+    const SCM strs[] = { keytype, description };
+    size_t offsets[2];
+
+    sa->strings = stage_job_strings(strs, offsets, 2, s_keyctl_search_any);
+    sa->type = sa->strings->data + offsets[0];
+    sa->description = sa->strings->data + offsets[1];
+  }
+
+  scm_dynwind_end();
+
+  /* The later tiers go to the workers, or are searched here after the
+     first if none will take them. A worker would resolve special ids
+     against its own keyrings, so they are resolved here first; one
+     that cannot be is left to be searched here, and missed. */
+  for(i = 1; i < sa->n; i++)
+    {
+      long serial = get_key_serial(sa->keyrings[i], 0);
+
+      if(serial < 0)
+	{
+	  continue;
+	}
+
+      sa->keyrings[i] = serial;
+      sa->tiers[i].job.run = run_search_tier;
+      sa->tiers[i].job.done = search_tier_done;
+      sa->tiers[i].sa = sa;
+
+      __atomic_add_fetch(&sa->refs, 1, __ATOMIC_RELAXED);
+      sa->tiers[i].queued = 1;
+
+      if(lkr_pool_submit(LKR_POOL_SEARCH, &sa->tiers[i].job) < 0)
+	{
+	  sa->tiers[i].queued = 0;
+	  __atomic_sub_fetch(&sa->refs, 1, __ATOMIC_RELAXED);
+	}
+    }
+
+  result = search_tier(sa, 0);
+  finish_tier(sa, 0, result);
+
+  for(i = 1; i < sa->n && result < 0; i++)
+    {
+      if(!sa->tiers[i].queued)
+	{
+	  result = search_tier(sa, i);
+	  finish_tier(sa, i, result);
+	}
+    }
+
+  result = (long)scm_without_guile(wait_search_any, sa);
+
+  search_any_unref(sa);
+
+  lkr_stat(LKR_STAT_SEARCH_ANY, result);
+
+  return result < 0 ? SCM_BOOL_F : scm_from_key_serial_t(result);
+}
+
+
+/* ******************************************************************
+   Initialization
+*/
+
+void
+init_lkr_key_job(void)
+{
+  key_job_tag = scm_make_smob_type("key-job", 0);
+  scm_set_smob_free(key_job_tag, free_key_job);
+  scm_set_smob_print(key_job_tag, print_key_job);
+
+  #include "async.x"
+}
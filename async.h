@@ -0,0 +1,26 @@
+/* Copyright (C) 2016 Kirk Zurell.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/* guile-linux-key-retention: key calls run on worker threads. */
+
+#ifndef GUILE_LKR_ASYNC_H
+#define GUILE_LKR_ASYNC_H
+
+void init_lkr_key_job(void);
+
+#endif /* GUILE_LKR_ASYNC_H */
@@ -0,0 +1,141 @@
+ ;; Copyright (C) 2016 Kirk Zurell.
+
+ ;; guile-linux-key-retention is free software; you can redistribute
+ ;; it and/or modify it under the terms of the GNU Lesser General
+ ;; Public License as published by the Free Software Foundation;
+ ;; either version 3 of the License, or (at your option) any later
+ ;; version.
+
+ ;; This library is distributed in the hope that it will be useful, but
+ ;; WITHOUT ANY WARRANTY; without even the implied warranty of
+ ;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ ;; Lesser General Public License for more details.
+
+ ;; You should have received a copy of the GNU Lesser General Public
+ ;; License along with this library; if not, write to the Free Software
+ ;; Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ ;; 02110-1301 USA
+
+;;; The Scheme side of "make bench": the calls bench/keyutils-bench
+;;; makes, through the bindings, in the same output format.
+;;;
+;;; Payloads are passed both as strings ("string" rows) and as
+;;; bytevectors ("bytevector" rows). Allocations per operation are
+;;; only counted when bench/malloc-count is preloaded; GC bytes per
+;;; operation always are.
+;;;
+;;; With malloc-count preloaded, the script fails if any operation
+;;; averages 0.01 heap allocations or more: the wrappers stage
+;;; arguments and payloads in the arena (see arena.c), so a steady
+;;; state call should not allocate at all. The margin is for other
+;;; threads, such as the collector's, which are counted too.
+;;;
+;;; LKR_BENCH_ITERATIONS sets the number of iterations.
+
+(use-modules (ice-9 format)
+             (system foreign)
+             (rnrs bytevectors)
+             (linux-key-retention guile-linux-key-retention))
+
+(define iterations
+  (or (and=> (getenv "LKR_BENCH_ITERATIONS") string->number) 10000))
+
+;; The "user" key type takes payloads of at most 32767 bytes.
+(define payload-sizes '(16 128 1024 8192 32767))
+
+(define description "lkr-bench:key")
+
+(define malloc-count
+  (catch #t
+    (lambda ()
+      (pointer->procedure unsigned-long
+                          (dynamic-func "lkr_bench_malloc_count"
+                                        (dynamic-link))
+                          '()))
+    (lambda _
+      #f)))
+
+(define (now-ns)
+  (let ((t (gettimeofday)))
+    (* 1000 (+ (* 1000000 (car t)) (cdr t)))))
+
+(define (gc-bytes)
+  (assq-ref (gc-stats) 'heap-total-allocated))
+
+(define keyring (add-key "keyring" "lkr-bench" #f KEY_SPEC_PROCESS_KEYRING))
+(define other-keyring
+  (add-key "keyring" "lkr-bench-other" #f KEY_SPEC_PROCESS_KEYRING))
+(define key (add-key "user" description "x" keyring))
+
+(define failures '())
+
+(define (run impl name size thunk)
+  ;; Warm up first, so that one-off allocations are not counted.
+  (thunk)
+  (let ((mallocs (and malloc-count (malloc-count)))
+        (gc (gc-bytes))
+        (start (now-ns)))
+    (let loop ((i 0))
+      (when (< i iterations)
+        (thunk)
+        (loop (1+ i))))
+    (let ((elapsed (- (now-ns) start))
+          (gc (- (gc-bytes) gc))
+          (mallocs (and mallocs (- (malloc-count) mallocs))))
+      (format #t "~a\t~a\t~a\t~a\t~,1f\t~a\t~,1f~%"
+              impl name size iterations
+              (exact->inexact (/ elapsed iterations))
+              (if mallocs
+                  (number->string (exact->inexact (/ mallocs iterations)))
+                  "-")
+              (exact->inexact (/ gc iterations)))
+      (when (and mallocs (>= (* 100 mallocs) iterations))
+        (set! failures
+              (cons (format #f "~a ~a ~a: ~a allocations per op"
+                            impl name size
+                            (exact->inexact (/ mallocs iterations)))
+                    failures))))))
+
+(define (sized-ops payload)
+  `(("add" . ,(lambda () (add-key "user" description payload keyring)))
+    ("update" . ,(lambda () (keyctl-update key payload)))
+    ("read" . ,(lambda () (keyctl-read key)))))
+
+(define unsized-ops
+  `(("describe" . ,(lambda () (keyctl-describe key)))
+    ("search" . ,(lambda () (keyctl-search keyring "user" description)))
+    ("link-unlink" . ,(lambda ()
+                        (keyctl-link other-keyring key)
+                        (keyctl-unlink other-keyring key)))
+    ("request-key" . ,(lambda () (request-key "user" description)))))
+
+(format #t "# impl\top\tsize\titerations\tns_per_op\tallocs_per_op\tgc_bytes_per_op~%")
+
+(for-each
+ (lambda (impl make-payload)
+   (for-each
+    (lambda (size)
+      (let ((payload (make-payload size)))
+        ;; Leave the key holding this payload size for "read".
+        (keyctl-update key payload)
+        (for-each (lambda (op)
+                    (run impl (car op) size (cdr op)))
+                  (sized-ops payload))))
+    payload-sizes))
+ '("string" "bytevector")
+ (list (lambda (size) (make-string size #\x))
+       (lambda (size) (make-bytevector size (char->integer #\x)))))
+
+(keyctl-update key "x")
+(for-each (lambda (op)
+            (run "scheme" (car op) 0 (cdr op)))
+          unsized-ops)
+
+(keyctl-clear keyring)
+(keyctl-clear other-keyring)
+
+(unless (null? failures)
+  (for-each (lambda (failure)
+              (format (current-error-port) "bindings.scm: ~a~%" failure))
+            (reverse failures))
+  (exit 1))
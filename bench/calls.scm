@@ -0,0 +1,80 @@
+ ;; Copyright (C) 2016 Kirk Zurell.
+
+ ;; guile-linux-key-retention is free software; you can redistribute
+ ;; it and/or modify it under the terms of the GNU Lesser General
+ ;; Public License as published by the Free Software Foundation;
+ ;; either version 3 of the License, or (at your option) any later
+ ;; version.
+
+ ;; This library is distributed in the hope that it will be useful, but
+ ;; WITHOUT ANY WARRANTY; without even the implied warranty of
+ ;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ ;; Lesser General Public License for more details.
+
+ ;; You should have received a copy of the GNU Lesser General Public
+ ;; License along with this library; if not, write to the Free Software
+ ;; Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ ;; 02110-1301 USA
+
+;;; Wrapper call throughput, for comparing Guile versions.
+;;;
+;;; Meant to run under bench/keyutils-sim, where a key call costs a
+;;; few hundred nanoseconds, so that the time measured is mostly the
+;;; Scheme side: the call into the extension, argument conversion and
+;;; building the result. The "scheme" row is a call to a Scheme
+;;; procedure that does nothing, as a floor. One tab-separated line is
+;;; printed per call, tagged with the Guile version; see
+;;; bench/guile-versions.sh.
+;;;
+;;; LKR_BENCH_CALLS sets the number of calls (default 100000).
+
+(use-modules (rnrs bytevectors)
+             (linux-key-retention guile-linux-key-retention))
+
+(define iterations
+  (or (and=> (getenv "LKR_BENCH_CALLS") string->number) 100000))
+
+(define (now-ns)
+  (let ((t (gettimeofday)))
+    (* 1000 (+ (* 1000000 (car t)) (cdr t)))))
+
+(define keyring (add-key "keyring" "lkr-bench-calls" #f KEY_SPEC_PROCESS_KEYRING))
+(define key (add-key "user" "lkr-bench-calls:key" "0123456789abcdef" keyring))
+(define handle (make-key-handle key))
+(define payload (make-bytevector 16 0))
+
+;; Not inlined into the loop, as it is called through a variable.
+(define (nothing x)
+  x)
+
+(define calls
+  `(("scheme" . ,(lambda () (nothing key)))
+    ("get-keyring-id" . ,(lambda () (keyctl-get-keyring-id KEY_SPEC_PROCESS_KEYRING)))
+    ("set-timeout" . ,(lambda () (keyctl-set-timeout key 0)))
+    ("search" . ,(lambda () (keyctl-search keyring "user" "lkr-bench-calls:key")))
+    ("read" . ,(lambda () (keyctl-read key)))
+    ("update-bytevector" . ,(lambda () (keyctl-update key payload)))
+    ("key-handle-type" . ,(lambda () (key-handle-type handle)))))
+
+(define (run name thunk)
+  (thunk)
+  (let ((start (now-ns)))
+    (let loop ((i 0))
+      (when (< i iterations)
+        (thunk)
+        (loop (1+ i))))
+    (let ((elapsed (- (now-ns) start)))
+      (format #t "~a\t~a\t~a\t~a\t~a~%"
+              (effective-version) name iterations
+              (exact->inexact (/ elapsed iterations))
+              (if (zero? elapsed)
+                  "-"
+                  (round (/ (* iterations 1000000000) elapsed)))))))
+
+(format #t "# guile\tcall\titerations\tns_per_call\tcalls_per_sec~%")
+
+(for-each (lambda (call)
+            (run (car call) (cdr call)))
+          calls)
+
+(keyctl-clear keyring)
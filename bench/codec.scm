@@ -0,0 +1,103 @@
+ ;; Copyright (C) 2016 Kirk Zurell.
+
+ ;; guile-linux-key-retention is free software; you can redistribute
+ ;; it and/or modify it under the terms of the GNU Lesser General
+ ;; Public License as published by the Free Software Foundation;
+ ;; either version 3 of the License, or (at your option) any later
+ ;; version.
+
+ ;; This library is distributed in the hope that it will be useful, but
+ ;; WITHOUT ANY WARRANTY; without even the implied warranty of
+ ;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ ;; Lesser General Public License for more details.
+
+ ;; You should have received a copy of the GNU Lesser General Public
+ ;; License along with this library; if not, write to the Free Software
+ ;; Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ ;; 02110-1301 USA
+
+;;; Encoding and decoding callout information and payloads: key=value
+;;; text, as upcall handlers have done it, against key records.
+;;;
+;;; The fields are those of a typical credential: a host, a port, a
+;;; user, an expiry and a 32-byte token, which the text form carries
+;;; in hex. Each row gives the time per encode or decode and the size
+;;; of the encoded form. No key calls are made.
+
+(use-modules (ice-9 format)
+             (rnrs bytevectors)
+             (linux-key-retention guile-linux-key-retention))
+
+(define iterations
+  (or (and=> (getenv "LKR_BENCH_ITERATIONS") string->number) 10000))
+
+(define (now-ns)
+  (let ((t (gettimeofday)))
+    (* 1000 (+ (* 1000000 (car t)) (cdr t)))))
+
+(define fields
+  `((host . "db1.example.com")
+    (port . 5432)
+    (user . "myapp")
+    (expiry . 1735689600)
+    (token . ,(u8-list->bytevector (iota 32)))))
+
+(define (bytevector->hex bv)
+  (string-concatenate
+   (map (lambda (b) (format #f "~2,'0x" b))
+        (bytevector->u8-list bv))))
+
+(define (hex->bytevector s)
+  (let ((bv (make-bytevector (quotient (string-length s) 2))))
+    (do ((i 0 (1+ i))) ((= i (bytevector-length bv)) bv)
+      (bytevector-u8-set! bv i (string->number (substring s (* 2 i) (* 2 (1+ i))) 16)))))
+
+(define (fields->text fields)
+  (string-join
+   (map (lambda (field)
+          (string-append (symbol->string (car field)) "="
+                         (let ((value (cdr field)))
+                           (cond ((number? value) (number->string value))
+                                 ((bytevector? value) (bytevector->hex value))
+                                 (else value)))))
+        fields)
+   ","))
+
+;; The handler knows which fields are numbers and which are bytes.
+(define (text->fields text)
+  (map (lambda (pair)
+         (let* ((i (string-index pair #\=))
+                (name (string->symbol (substring pair 0 i)))
+                (value (substring pair (1+ i))))
+           (cons name
+                 (case name
+                   ((port expiry) (string->number value))
+                   ((token) (hex->bytevector value))
+                   (else value)))))
+       (string-split text #\,)))
+
+(define (size x)
+  (if (string? x) (string-length x) (bytevector-length x)))
+
+(define (run name encode decode)
+  (let ((encoded (encode fields)))
+    (unless (equal? (decode encoded) fields)
+      (error "round trip failed" name))
+    (for-each
+     (lambda (op thunk)
+       (let ((start (now-ns)))
+         (do ((i 0 (1+ i))) ((= i iterations))
+           (thunk))
+         (format #t "~a\t~a\t~a\t~a\t~a~%"
+                 name op iterations
+                 (exact->inexact (/ (- (now-ns) start) iterations))
+                 (size encoded))))
+     '("encode" "decode")
+     (list (lambda () (encode fields))
+           (lambda () (decode encoded))))))
+
+(format #t "# format\top\titerations\tns_per_op\tbytes~%")
+
+(run "text" fields->text text->fields)
+(run "record" key-record->bytevector bytevector->key-record)
+(run "callout-info" key-record->callout-info callout-info->key-record)
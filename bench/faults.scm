@@ -0,0 +1,75 @@
+ ;; Copyright (C) 2016 Kirk Zurell.
+
+ ;; guile-linux-key-retention is free software; you can redistribute
+ ;; it and/or modify it under the terms of the GNU Lesser General
+ ;; Public License as published by the Free Software Foundation;
+ ;; either version 3 of the License, or (at your option) any later
+ ;; version.
+
+ ;; This library is distributed in the hope that it will be useful, but
+ ;; WITHOUT ANY WARRANTY; without even the implied warranty of
+ ;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ ;; Lesser General Public License for more details.
+
+ ;; You should have received a copy of the GNU Lesser General Public
+ ;; License along with this library; if not, write to the Free Software
+ ;; Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ ;; 02110-1301 USA
+
+;;; Fault injection through the bindings, under bench/keyutils-sim.
+;;;
+;;; Run with LKR_SIM_FAULTS set (see "make bench-sim"). Each operation
+;;; is called LKR_BENCH_ITERATIONS times, and the outcomes are counted
+;;; by errno, so that injected faults can be checked to surface as
+;;; system-error exceptions carrying the injected errno.
+
+(use-modules (linux-key-retention guile-linux-key-retention))
+
+(define iterations
+  (or (and=> (getenv "LKR_BENCH_ITERATIONS") string->number) 1000))
+
+(define keyring (add-key "keyring" "lkr-faults" #f KEY_SPEC_PROCESS_KEYRING))
+(define key (add-key "user" "lkr-faults:key" "payload" keyring))
+
+(define (errno-name errno)
+  (let loop ((names '(EACCES EDQUOT EINVAL EKEYEXPIRED EKEYREJECTED
+                      EKEYREVOKED ENOKEY ENOMEM EPERM)))
+    (cond ((null? names) (number->string errno))
+          ((and (defined? (car names))
+                (eqv? errno (module-ref (current-module) (car names))))
+           (symbol->string (car names)))
+          (else (loop (cdr names))))))
+
+(define (run name thunk)
+  (let ((outcomes (make-hash-table)))
+    (let loop ((i 0))
+      (when (< i iterations)
+        (let ((outcome (catch 'system-error
+                         (lambda ()
+                           (thunk)
+                           "ok")
+                         (lambda args
+                           (errno-name (system-error-errno args))))))
+          (hash-set! outcomes outcome (1+ (hash-ref outcomes outcome 0))))
+        (loop (1+ i))))
+    (hash-for-each (lambda (outcome count)
+                     (format #t "~a\t~a\t~a\t~a~%" name iterations outcome count))
+                   outcomes)))
+
+(format #t "# op\tcalls\toutcome\tcount~%")
+
+(run "add-key" (lambda () (add-key "user" "lkr-faults:key" "payload" keyring)))
+(run "keyctl-update" (lambda () (keyctl-update key "payload")))
+(run "keyctl-read" (lambda () (keyctl-read key)))
+(run "keyctl-search" (lambda () (keyctl-search keyring "user" "lkr-faults:key")))
+(run "request-key" (lambda () (request-key "user" "lkr-faults:key")))
+
+;; Real, rather than injected, quota exhaustion.
+(run "add-key-new"
+     (let ((n 0))
+       (lambda ()
+         (set! n (1+ n))
+         (add-key "user" (string-append "lkr-faults:" (number->string n))
+                  "payload" keyring))))
+
+(keyctl-clear keyring)
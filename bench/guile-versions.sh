@@ -0,0 +1,68 @@
+#!/bin/sh
+#
+# Copyright (C) 2016 Kirk Zurell.
+#
+# guile-linux-key-retention is free software; you can redistribute it
+# and/or modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either version
+# 3, or (at your option) any later version.
+#
+# Builds the extension once per installed Guile version, each in its
+# own directory under the current one, runs "make check" in each, and
+# runs bench/calls.scm against each build under the keyutils
+# simulator. The results are printed together, one line per version
+# and call; a build that fails or warns, or a failing check, stops the
+# run with the log of that build.
+#
+# Usage: guile-versions.sh SRCDIR [VERSION...]
+#
+# The versions default to 2.0, 2.2 and 3.0; those whose development
+# files pkg-config cannot find are skipped. Each build is configured
+# from SRCDIR, so SRCDIR must not itself be configured in place.
+
+set -e
+
+srcdir=`cd "${1:?usage: $0 SRCDIR [VERSION...]}" && pwd`
+shift
+
+if test -f "$srcdir"/config.status; then
+    echo "$0: $srcdir is configured in place; configure it in a" \
+	"separate build directory instead" >&2
+    exit 1
+fi
+
+versions=${*:-"2.0 2.2 3.0"}
+header=yes
+
+for v in $versions; do
+    if ! pkg-config --exists guile-$v; then
+	echo "# guile-$v: not installed, skipped" >&2
+	continue
+    fi
+
+    dir=bench-guile-$v
+    mkdir -p $dir
+
+    echo "# guile-$v: building in $dir" >&2
+    if ! (cd $dir &&
+	"$srcdir"/configure -q GUILE_EFFECTIVE_VERSION=$v &&
+	${MAKE:-make} -s &&
+	${MAKE:-make} -s check) > $dir/build.log 2>&1; then
+	cat $dir/build.log >&2
+	exit 1
+    fi
+    if grep -q 'warning:' $dir/build.log; then
+	grep 'warning:' $dir/build.log >&2
+	echo "# guile-$v: the build is not warning-clean" >&2
+	exit 1
+    fi
+    echo "# guile-$v: make check passed" >&2
+
+    (cd $dir && ${MAKE:-make} -s bench-calls) > $dir/bench-calls.out
+
+    if test $header = yes; then
+	grep '^#' $dir/bench-calls.out
+	header=no
+    fi
+    grep -v '^#' $dir/bench-calls.out
+done
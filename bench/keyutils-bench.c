@@ -0,0 +1,238 @@
+/* Copyright (C) 2016 Kirk Zurell.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/* keyutils-bench: the baseline for bench/bindings.scm.
+
+   Makes the same calls as the Scheme benchmark, straight through
+   libkeyutils, against a keyring private to the process. The
+   difference between the two is the cost of the bindings.
+
+   Usage: keyutils-bench [-n ITERATIONS]
+
+   Prints one tab-separated line per operation and payload size, in
+   the same format as bench/bindings.scm.
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <keyutils.h>
+
+/* The "user" key type takes payloads of at most 32767 bytes. */
+static const size_t payload_sizes[] = { 16, 128, 1024, 8192, 32767 };
+
+#define N_PAYLOAD_SIZES (sizeof(payload_sizes) / sizeof(payload_sizes[0]))
+#define MAX_PAYLOAD 32767
+
+#define DESCRIPTION "lkr-bench:key"
+
+unsigned long lkr_bench_malloc_count(void);
+
+static key_serial_t keyring;
+static key_serial_t other_keyring;
+static key_serial_t key;
+
+static char payload[MAX_PAYLOAD];
+static char buffer[MAX_PAYLOAD + 1];
+static size_t payload_size;
+
+static long long
+now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+
+/* ******************************************************************
+   Operations. Each returns a negative value on error.
+*/
+
+static long
+op_add(void)
+{
+  return add_key("user", DESCRIPTION, payload, payload_size, keyring);
+}
+
+static long
+op_update(void)
+{
+  return keyctl(KEYCTL_UPDATE, key, payload, payload_size);
+}
+
+static long
+op_read(void)
+{
+  return keyctl(KEYCTL_READ, key, buffer, sizeof(buffer));
+}
+
+static long
+op_describe(void)
+{
+  return keyctl(KEYCTL_DESCRIBE, key, buffer, 256);
+}
+
+static long
+op_search(void)
+{
+  return keyctl(KEYCTL_SEARCH, keyring, "user", DESCRIPTION, 0);
+}
+
+static long
+op_link_unlink(void)
+{
+  long result = keyctl(KEYCTL_LINK, other_keyring, key);
+
+  return result < 0 ? result : keyctl(KEYCTL_UNLINK, other_keyring, key);
+}
+
+static long
+op_request_key(void)
+{
+  return request_key("user", DESCRIPTION, NULL, 0);
+}
+
+struct bench_op
+{
+  const char *name;
+  long (*run)(void);
+  int sized; /* Whether the payload size matters. */
+};
+
+static const struct bench_op ops[] = {
+  { "add", op_add, 1 },
+  { "update", op_update, 1 },
+  { "read", op_read, 1 },
+  { "describe", op_describe, 0 },
+  { "search", op_search, 0 },
+  { "link-unlink", op_link_unlink, 0 },
+  { "request-key", op_request_key, 0 },
+};
+
+#define N_OPS (sizeof(ops) / sizeof(ops[0]))
+
+
+
+static int
+run(const struct bench_op *op, long iterations)
+{
+  unsigned long mallocs;
+  long long start;
+  long long elapsed;
+  long i;
+
+  /* Warm up, and leave the key holding this payload size. */
+  if(op->run() < 0 || op_update() < 0)
+    {
+      fprintf(stderr, "keyutils-bench: %s: %s\n", op->name, strerror(errno));
+      return -1;
+    }
+
+  mallocs = lkr_bench_malloc_count();
+  start = now_ns();
+
+  for(i = 0; i < iterations; i++)
+    {
+      if(op->run() < 0)
+	{
+	  fprintf(stderr, "keyutils-bench: %s: %s\n", op->name, strerror(errno));
+	  return -1;
+	}
+    }
+
+  elapsed = now_ns() - start;
+  mallocs = lkr_bench_malloc_count() - mallocs;
+
+  printf("c\t%s\t%zu\t%ld\t%.1f\t%.2f\t0\n",
+	 op->name,
+	 op->sized ? payload_size : 0,
+	 iterations,
+	 (double)elapsed / iterations,
+	 (double)mallocs / iterations);
+
+  return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+  long iterations = 10000;
+  int status = 0;
+  size_t i, j;
+  int opt;
+
+  while((opt = getopt(argc, argv, "n:")) != -1)
+    {
+      switch(opt)
+	{
+	case 'n':
+	  iterations = atol(optarg);
+	  break;
+	default:
+	  fprintf(stderr, "Usage: %s [-n ITERATIONS]\n", argv[0]);
+	  return 2;
+	}
+    }
+
+  if(iterations < 1)
+    {
+      fprintf(stderr, "Usage: %s [-n ITERATIONS]\n", argv[0]);
+      return 2;
+    }
+
+  memset(payload, 'x', sizeof(payload));
+
+  keyring = add_key("keyring", "lkr-bench", NULL, 0, KEY_SPEC_PROCESS_KEYRING);
+  other_keyring = add_key("keyring", "lkr-bench-other", NULL, 0, KEY_SPEC_PROCESS_KEYRING);
+  payload_size = payload_sizes[0];
+  key = add_key("user", DESCRIPTION, payload, payload_size, keyring);
+
+  if(keyring < 0 || other_keyring < 0 || key < 0)
+    {
+      perror("keyutils-bench: add_key");
+      return 1;
+    }
+
+  printf("# impl\top\tsize\titerations\tns_per_op\tallocs_per_op\tgc_bytes_per_op\n");
+
+  for(i = 0; i < N_OPS; i++)
+    {
+      for(j = 0; j < (ops[i].sized ? N_PAYLOAD_SIZES : 1); j++)
+	{
+	  payload_size = payload_sizes[j];
+
+	  if(run(&ops[i], iterations) < 0)
+	    {
+	      status = 1;
+	    }
+	}
+    }
+
+  keyctl(KEYCTL_CLEAR, keyring);
+  keyctl(KEYCTL_CLEAR, other_keyring);
+
+  return status;
+}
@@ -0,0 +1,1767 @@
+/* Copyright (C) 2016 Kirk Zurell.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/* keyutils-sim: an in-memory stand-in for the kernel key service.
+
+   Provides add_key, request_key and keyctl, the libkeyutils entry
+   points the bindings use. LD_PRELOAD it, or link it ahead of
+   libkeyutils, to run the benchmarks where the kernel keyring is
+   unavailable, restricted or shared.
+
+   It keeps keys and keyrings, the special keyrings, permissions,
+   quotas and timeouts for one process, under one lock. Keys are found
+   by serial through a hash index, and each key records the keyrings
+   that link to it. A key that no keyring links to, and that is
+   neither a special keyring nor under construction, is destroyed at
+   once, as the kernel's garbage collector would destroy it, so its
+   quota is returned. Possession is simplified: a key is possessed if
+   it can be reached from the thread, process or session keyring. Security labels are empty.
+   There is one persistent keyring, the caller's, and it never
+   expires. Restricted keyrings check the type of what is linked into
+   them but not signatures: any "asymmetric" key, whose payload is
+   taken as given, satisfies an asymmetric restriction.
+
+   request_key() for a key that does not exist simulates an upcall:
+   after LKR_SIM_UPCALL_NS nanoseconds the key is instantiated with
+   the callout information, or negated if there is none.
+
+   Environment:
+
+   LKR_SIM_UPCALL_NS     Simulated upcall latency, in nanoseconds.
+   LKR_SIM_MAXKEYS       Per-user key quota (default 200).
+   LKR_SIM_MAXBYTES      Per-user byte quota (default 20000).
+   LKR_SIM_FAULTS        Comma-separated OP:ERRNO:N entries. Every Nth
+                         call of OP fails with ERRNO. OP is "add_key",
+                         "request_key", a keyctl command name in lower
+                         case ("read", "search", ...) or "*". ERRNO is
+                         a name such as EDQUOT, ENOKEY or EKEYEXPIRED.
+
+   lkr_sim_upcall_count() returns the number of simulated upcalls.
+*/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <keyutils.h>
+
+#ifndef KEYCTL_RESTRICT_KEYRING
+#define KEYCTL_RESTRICT_KEYRING 29
+#endif
+
+#define SIM_MAX_FAULTS 16
+
+struct sim_key
+{
+  key_serial_t serial;
+  char type[32];
+  char *description;
+  char *payload;
+  size_t plen;
+  uid_t uid;
+  gid_t gid;
+  key_perm_t perm;
+  time_t expiry;       /* 0 for none. */
+  int instantiated;
+  int negative_error;  /* Non-zero for negative keys. */
+  int revoked;
+
+  /* Keyrings only. */
+  key_serial_t *links;
+  size_t nlinks;
+  size_t maxlinks;
+  int restricted;
+  char restrict_type[32];  /* Empty if nothing may be linked. */
+
+  /* The keyrings that link to this key. */
+  key_serial_t *parents;
+  size_t nparents;
+  size_t maxparents;
+
+  /* Held by a special keyring slot, or by a request_key() constructing
+     the key. A key with no parents and no pins is destroyed. */
+  int pinned;
+
+  struct sim_key *next;
+  struct sim_key *prev;
+};
+
+struct sim_fault
+{
+  char op[32];
+  int error;
+  unsigned long every;
+  unsigned long calls;
+};
+
+static pthread_mutex_t sim_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sim_constructed = PTHREAD_COND_INITIALIZER;
+static pthread_once_t sim_once = PTHREAD_ONCE_INIT;
+
+static struct sim_key *sim_keys;
+static key_serial_t sim_next_serial = 100000000;
+
+/* Open addressing on the serial, with linear probing. Its size is a
+   power of two, and at most half of it is used. */
+static struct sim_key **sim_index;
+static size_t sim_index_size;
+
+static key_serial_t process_keyring;
+static key_serial_t session_keyring;
+static key_serial_t user_keyring;
+static key_serial_t user_session_keyring;
+static key_serial_t persistent_keyring;
+static __thread key_serial_t thread_keyring;
+static __thread int reqkey_defl;
+
+/* Unpins a thread's keyring when the thread exits. */
+static pthread_key_t thread_keyring_key;
+
+static long upcall_ns;
+static unsigned long maxkeys = 200;
+static unsigned long maxbytes = 20000;
+static unsigned long used_keys;
+static unsigned long used_bytes;
+static unsigned long upcall_count;
+
+static struct sim_fault faults[SIM_MAX_FAULTS];
+static int nfaults;
+
+/* bench/malloc-count, when it is preloaded too: the simulator's own
+   allocations stand in for the kernel's, and are not the bindings'. */
+extern void lkr_bench_malloc_pause(int pause) __attribute__((weak));
+
+static void sim_init(void);
+static void release_thread_keyring(void *serial);
+
+static void
+sim_lock_enter(void)
+{
+  pthread_once(&sim_once, sim_init);
+
+  if(lkr_bench_malloc_pause)
+    {
+      lkr_bench_malloc_pause(1);
+    }
+
+  pthread_mutex_lock(&sim_lock);
+}
+
+static void
+sim_lock_leave(void)
+{
+  pthread_mutex_unlock(&sim_lock);
+
+  if(lkr_bench_malloc_pause)
+    {
+      lkr_bench_malloc_pause(0);
+    }
+}
+
+static const char *keyctl_names[] = {
+  "get_keyring_id", "join_session_keyring", "update", "revoke", "chown",
+  "setperm", "describe", "clear", "link", "unlink", "search", "read",
+  "instantiate", "negate", "set_reqkey_keyring", "set_timeout",
+  "assume_authority", "get_security", "session_to_parent", "reject",
+  "instantiate_iov", "invalidate", "get_persistent", "dh_compute",
+  "pkey_query", "pkey_encrypt", "pkey_decrypt", "pkey_sign", "pkey_verify",
+  "restrict_keyring",
+};
+
+#define N_KEYCTL_NAMES (sizeof(keyctl_names) / sizeof(keyctl_names[0]))
+
+unsigned long
+lkr_sim_upcall_count(void)
+{
+  return __atomic_load_n(&upcall_count, __ATOMIC_RELAXED);
+}
+
+
+
+/* ******************************************************************
+   Configuration and fault injection
+*/
+
+static int
+errno_from_name(const char *name)
+{
+  static const struct { const char *name; int error; } names[] = {
+    { "EACCES", EACCES }, { "EDQUOT", EDQUOT }, { "EINVAL", EINVAL },
+    { "EKEYEXPIRED", EKEYEXPIRED }, { "EKEYREJECTED", EKEYREJECTED },
+    { "EKEYREVOKED", EKEYREVOKED }, { "ENOKEY", ENOKEY },
+    { "ENOMEM", ENOMEM }, { "EPERM", EPERM }, { "EINTR", EINTR },
+    { "EAGAIN", EAGAIN },
+  };
+  size_t i;
+
+  for(i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+    {
+      if(strcmp(name, names[i].name) == 0)
+	{
+	  return names[i].error;
+	}
+    }
+
+  return atoi(name);
+}
+
+static void
+parse_faults(const char *spec)
+{
+  char *copy = strdup(spec);
+  char *save = NULL;
+  char *entry;
+
+  if(copy == NULL)
+    {
+      return;
+    }
+
+  for(entry = strtok_r(copy, ",", &save);
+      entry && nfaults < SIM_MAX_FAULTS;
+      entry = strtok_r(NULL, ",", &save))
+    {
+      char *error = strchr(entry, ':');
+      char *every = error ? strchr(error + 1, ':') : NULL;
+      struct sim_fault *fault = &faults[nfaults];
+
+      if(every == NULL)
+	{
+	  continue;
+	}
+
+      *error++ = '\0';
+      *every++ = '\0';
+
+      strncpy(fault->op, entry, sizeof(fault->op) - 1);
+      fault->error = errno_from_name(error);
+      fault->every = strtoul(every, NULL, 10);
+
+      if(fault->error > 0 && fault->every > 0)
+	{
+	  nfaults++;
+	}
+    }
+
+  free(copy);
+}
+
+static void
+sim_init(void)
+{
+  const char *value;
+
+  if((value = getenv("LKR_SIM_UPCALL_NS")))
+    {
+      upcall_ns = atol(value);
+    }
+
+  if((value = getenv("LKR_SIM_MAXKEYS")))
+    {
+      maxkeys = strtoul(value, NULL, 10);
+    }
+
+  if((value = getenv("LKR_SIM_MAXBYTES")))
+    {
+      maxbytes = strtoul(value, NULL, 10);
+    }
+
+  if((value = getenv("LKR_SIM_FAULTS")))
+    {
+      parse_faults(value);
+    }
+
+  pthread_key_create(&thread_keyring_key, release_thread_keyring);
+}
+
+/* Returns the errno to fail this call of op with, or 0. Called with
+   the lock held. */
+static int
+injected_fault(const char *op)
+{
+  int i;
+
+  for(i = 0; i < nfaults; i++)
+    {
+      struct sim_fault *fault = &faults[i];
+
+      if((strcmp(fault->op, op) == 0 || strcmp(fault->op, "*") == 0)
+	 && ++fault->calls % fault->every == 0)
+	{
+	  return fault->error;
+	}
+    }
+
+  return 0;
+}
+
+
+
+/* ******************************************************************
+   Keys
+*/
+
+static size_t
+index_slot(key_serial_t serial)
+{
+  return ((uint32_t)serial * 2654435761u) & (sim_index_size - 1);
+}
+
+static struct sim_key *
+find_key(key_serial_t serial)
+{
+  size_t i;
+
+  if(sim_index_size == 0)
+    {
+      return NULL;
+    }
+
+  for(i = index_slot(serial); sim_index[i]; i = (i + 1) & (sim_index_size - 1))
+    {
+      if(sim_index[i]->serial == serial)
+	{
+	  return sim_index[i];
+	}
+    }
+
+  return NULL;
+}
+
+static void
+index_put(struct sim_key *key)
+{
+  size_t i;
+
+  for(i = index_slot(key->serial); sim_index[i]; i = (i + 1) & (sim_index_size - 1))
+    ;
+
+  sim_index[i] = key;
+}
+
+/* Makes room for one more key. Returns 0, or ENOMEM. */
+static int
+index_reserve(void)
+{
+  struct sim_key **old = sim_index;
+  size_t old_size = sim_index_size;
+  size_t i;
+
+  if(2 * (used_keys + 1) <= sim_index_size)
+    {
+      return 0;
+    }
+
+  sim_index_size = old_size ? 2 * old_size : 256;
+
+  if((sim_index = calloc(sim_index_size, sizeof(*sim_index))) == NULL)
+    {
+      sim_index = old;
+      sim_index_size = old_size;
+      return ENOMEM;
+    }
+
+  for(i = 0; i < old_size; i++)
+    {
+      if(old[i])
+	{
+	  index_put(old[i]);
+	}
+    }
+
+  free(old);
+
+  return 0;
+}
+
+/* Removes key, moving back the keys probed past its slot. */
+static void
+index_remove(struct sim_key *key)
+{
+  size_t mask = sim_index_size - 1;
+  size_t i = index_slot(key->serial);
+  size_t j;
+
+  while(sim_index[i] != key)
+    {
+      i = (i + 1) & mask;
+    }
+
+  sim_index[i] = NULL;
+
+  for(j = (i + 1) & mask; sim_index[j]; j = (j + 1) & mask)
+    {
+      size_t home = index_slot(sim_index[j]->serial);
+
+      /* Move it if its home is not cyclically within (i, j]. */
+      if(((j - home) & mask) >= ((j - i) & mask))
+	{
+	  sim_index[i] = sim_index[j];
+	  sim_index[j] = NULL;
+	  i = j;
+	}
+    }
+}
+
+static int
+is_keyring(const struct sim_key *key)
+{
+  return strcmp(key->type, "keyring") == 0;
+}
+
+static int
+key_expired(const struct sim_key *key)
+{
+  return key->expiry && key->expiry <= time(NULL);
+}
+
+/* Returns 0 if key can be used, or the errno to fail with. */
+static int
+key_usable(const struct sim_key *key)
+{
+  if(key->revoked)
+    {
+      return EKEYREVOKED;
+    }
+
+  if(key_expired(key))
+    {
+      return EKEYEXPIRED;
+    }
+
+  if(key->negative_error)
+    {
+      return key->negative_error;
+    }
+
+  return 0;
+}
+
+static struct sim_key *
+new_key(const char *type, const char *description, const void *payload, size_t plen)
+{
+  struct sim_key *key;
+  size_t bytes = strlen(description) + plen;
+
+  if(used_keys + 1 > maxkeys || used_bytes + bytes > maxbytes)
+    {
+      errno = EDQUOT;
+      return NULL;
+    }
+
+  if((errno = index_reserve()))
+    {
+      return NULL;
+    }
+
+  key = calloc(1, sizeof(*key));
+
+  if(key == NULL
+     || (key->description = strdup(description)) == NULL
+     || (plen && (key->payload = malloc(plen)) == NULL))
+    {
+      if(key)
+	{
+	  free(key->description);
+	}
+
+      free(key);
+      errno = ENOMEM;
+      return NULL;
+    }
+
+  strncpy(key->type, type, sizeof(key->type) - 1);
+
+  if(plen)
+    {
+      memcpy(key->payload, payload, plen);
+    }
+
+  key->plen = plen;
+  key->serial = sim_next_serial++;
+  key->uid = getuid();
+  key->gid = getgid();
+  key->perm = KEY_POS_ALL | KEY_USR_VIEW | KEY_USR_READ | KEY_USR_WRITE
+    | KEY_USR_SEARCH | KEY_USR_LINK | KEY_USR_SETATTR;
+  key->instantiated = 1;
+
+  key->next = sim_keys;
+
+  if(sim_keys)
+    {
+      sim_keys->prev = key;
+    }
+
+  sim_keys = key;
+  index_put(key);
+
+  used_keys++;
+  used_bytes += bytes;
+
+  return key;
+}
+
+/* Adds serial to the array *arr of *n, with room for *max. Returns 0,
+   or ENOMEM. */
+static int
+serials_add(key_serial_t **arr, size_t *n, size_t *max, key_serial_t serial)
+{
+  if(*n == *max)
+    {
+      size_t larger = *max ? *max * 2 : 8;
+      key_serial_t *grown = realloc(*arr, larger * sizeof(**arr));
+
+      if(grown == NULL)
+	{
+	  return ENOMEM;
+	}
+
+      *arr = grown;
+      *max = larger;
+    }
+
+  (*arr)[(*n)++] = serial;
+
+  return 0;
+}
+
+/* Removes serial from the array arr of *n. Returns whether it was
+   there. */
+static int
+serials_remove(key_serial_t *arr, size_t *n, key_serial_t serial)
+{
+  size_t i;
+
+  for(i = 0; i < *n; i++)
+    {
+      if(arr[i] == serial)
+	{
+	  arr[i] = arr[--*n];
+	  return 1;
+	}
+    }
+
+  return 0;
+}
+
+static void release_key(struct sim_key *key);
+
+/* Destroys key, unlinking it from the keyrings that link to it, and
+   releasing what it links to. */
+static void
+destroy_key(struct sim_key *key)
+{
+  size_t i;
+
+  index_remove(key);
+
+  if(key->prev)
+    {
+      key->prev->next = key->next;
+    }
+  else
+    {
+      sim_keys = key->next;
+    }
+
+  if(key->next)
+    {
+      key->next->prev = key->prev;
+    }
+
+  for(i = 0; i < key->nparents; i++)
+    {
+      struct sim_key *ring = find_key(key->parents[i]);
+
+      if(ring)
+	{
+	  serials_remove(ring->links, &ring->nlinks, key->serial);
+	}
+    }
+
+  for(i = 0; i < key->nlinks; i++)
+    {
+      struct sim_key *child = find_key(key->links[i]);
+
+      if(child && serials_remove(child->parents, &child->nparents, key->serial))
+	{
+	  release_key(child);
+	}
+    }
+
+  used_keys--;
+  used_bytes -= strlen(key->description) + key->plen;
+
+  free(key->description);
+  free(key->payload);
+  free(key->links);
+  free(key->parents);
+  free(key);
+}
+
+/* Destroys key if nothing holds it any longer. */
+static void
+release_key(struct sim_key *key)
+{
+  if(key->nparents == 0 && key->pinned == 0)
+    {
+      destroy_key(key);
+    }
+}
+
+static int
+set_payload(struct sim_key *key, const void *payload, size_t plen)
+{
+  char *copy = NULL;
+
+  if(used_bytes - key->plen + plen > maxbytes)
+    {
+      return EDQUOT;
+    }
+
+  if(plen && (copy = malloc(plen)) == NULL)
+    {
+      return ENOMEM;
+    }
+
+  if(plen)
+    {
+      memcpy(copy, payload, plen);
+    }
+
+  used_bytes = used_bytes - key->plen + plen;
+
+  free(key->payload);
+  key->payload = copy;
+  key->plen = plen;
+
+  return 0;
+}
+
+
+
+/* ******************************************************************
+   Keyrings
+*/
+
+static key_serial_t
+special_keyring(key_serial_t *slot, const char *description)
+{
+  struct sim_key *key;
+
+  if(*slot && find_key(*slot))
+    {
+      return *slot;
+    }
+
+  key = new_key("keyring", description, NULL, 0);
+
+  if(key == NULL)
+    {
+      return -1;
+    }
+
+  key->pinned++;
+  *slot = key->serial;
+
+  if(slot == &thread_keyring)
+    {
+      pthread_setspecific(thread_keyring_key, (void *)(intptr_t)key->serial);
+    }
+
+  return key->serial;
+}
+
+static void
+release_thread_keyring(void *serial)
+{
+  struct sim_key *key;
+
+  sim_lock_enter();
+
+  if((key = find_key((key_serial_t)(intptr_t)serial)))
+    {
+      key->pinned--;
+      release_key(key);
+    }
+
+  sim_lock_leave();
+}
+
+/* Turns KEY_SPEC_* identifiers into serials, creating the special
+   keyring if create is set. Returns -1 with errno set on failure. */
+static key_serial_t
+resolve(key_serial_t id, int create)
+{
+  key_serial_t *slot = NULL;
+  const char *description = NULL;
+
+  switch(id)
+    {
+    case KEY_SPEC_THREAD_KEYRING:
+      slot = &thread_keyring;
+      description = "_tid";
+      break;
+    case KEY_SPEC_PROCESS_KEYRING:
+      slot = &process_keyring;
+      description = "_pid";
+      break;
+    case KEY_SPEC_SESSION_KEYRING:
+      slot = &session_keyring;
+      description = "_ses";
+      create = 1;
+      break;
+    case KEY_SPEC_USER_KEYRING:
+      slot = &user_keyring;
+      description = "_uid";
+      create = 1;
+      break;
+    case KEY_SPEC_USER_SESSION_KEYRING:
+      slot = &user_session_keyring;
+      description = "_uid_ses";
+      create = 1;
+      break;
+    case KEY_SPEC_GROUP_KEYRING:
+    case KEY_SPEC_REQKEY_AUTH_KEY:
+      errno = EINVAL;
+      return -1;
+    default:
+      if(find_key(id) == NULL)
+	{
+	  errno = ENOKEY;
+	  return -1;
+	}
+
+      return id;
+    }
+
+  if(*slot == 0 && !create)
+    {
+      errno = ENOKEY;
+      return -1;
+    }
+
+  return special_keyring(slot, description);
+}
+
+static struct sim_key *
+lookup(key_serial_t id, int create)
+{
+  key_serial_t serial = resolve(id, create);
+  struct sim_key *key = serial < 0 ? NULL : find_key(serial);
+
+  if(serial >= 0 && key == NULL)
+    {
+      errno = ENOKEY;
+    }
+
+  return key;
+}
+
+/* Whether a key of the given type may be linked into ring, as
+   errors from the kernel's restriction checks. */
+static int
+link_permitted(const struct sim_key *ring, const char *type)
+{
+  if(!ring->restricted)
+    {
+      return 0;
+    }
+
+  if(ring->restrict_type[0] == '\0')
+    {
+      return EPERM;
+    }
+
+  return strcmp(type, ring->restrict_type) ? EOPNOTSUPP : 0;
+}
+
+static int
+link_key(struct sim_key *ring, key_serial_t serial)
+{
+  struct sim_key *key = find_key(serial);
+  size_t i;
+  int error;
+
+  if(key == NULL)
+    {
+      return ENOKEY;
+    }
+
+  if((error = link_permitted(ring, key->type)))
+    {
+      return error;
+    }
+
+  for(i = 0; i < ring->nlinks; i++)
+    {
+      if(ring->links[i] == serial)
+	{
+	  return 0;
+	}
+    }
+
+  if((error = serials_add(&ring->links, &ring->nlinks, &ring->maxlinks, serial)))
+    {
+      return error;
+    }
+
+  if((error = serials_add(&key->parents, &key->nparents, &key->maxparents, ring->serial)))
+    {
+      ring->nlinks--;
+      return error;
+    }
+
+  return 0;
+}
+
+/* Unlinks serial from ring, destroying it if nothing else holds it.
+   Returns whether it was linked. */
+static int
+unlink_key(struct sim_key *ring, key_serial_t serial)
+{
+  struct sim_key *key = find_key(serial);
+
+  if(!serials_remove(ring->links, &ring->nlinks, serial))
+    {
+      return 0;
+    }
+
+  if(key && serials_remove(key->parents, &key->nparents, ring->serial))
+    {
+      release_key(key);
+    }
+
+  return 1;
+}
+
+/* Depth-first search of the tree headed by ring. */
+static struct sim_key *
+search_tree(struct sim_key *ring, const char *type, const char *description, int depth)
+{
+  size_t i;
+
+  if(depth > 6)
+    {
+      return NULL;
+    }
+
+  for(i = 0; i < ring->nlinks; i++)
+    {
+      struct sim_key *key = find_key(ring->links[i]);
+
+      if(key && !key->revoked && !key_expired(key)
+	 && strcmp(key->type, type) == 0
+	 && strcmp(key->description, description) == 0)
+	{
+	  return key;
+	}
+    }
+
+  for(i = 0; i < ring->nlinks; i++)
+    {
+      struct sim_key *sub = find_key(ring->links[i]);
+      struct sim_key *key;
+
+      if(sub && is_keyring(sub) && !sub->revoked
+	 && (key = search_tree(sub, type, description, depth + 1)))
+	{
+	  return key;
+	}
+    }
+
+  return NULL;
+}
+
+static struct sim_key *
+search_process_keyrings(const char *type, const char *description)
+{
+  key_serial_t rings[] = { thread_keyring, process_keyring, session_keyring };
+  size_t i;
+
+  for(i = 0; i < sizeof(rings) / sizeof(rings[0]); i++)
+    {
+      struct sim_key *ring = rings[i] ? find_key(rings[i]) : NULL;
+      struct sim_key *key = ring ? search_tree(ring, type, description, 0) : NULL;
+
+      if(key)
+	{
+	  return key;
+	}
+    }
+
+  return NULL;
+}
+
+/* Whether key is one of the n keyrings in rings, or is linked from one
+   through its parents, no deeper than search_tree looks. */
+static int
+descends_from(const struct sim_key *key, const key_serial_t *rings, size_t n, int depth)
+{
+  size_t i;
+
+  if(key == NULL || depth > 7)
+    {
+      return 0;
+    }
+
+  for(i = 0; i < n; i++)
+    {
+      if(rings[i] && key->serial == rings[i])
+	{
+	  return 1;
+	}
+    }
+
+  for(i = 0; i < key->nparents; i++)
+    {
+      if(descends_from(find_key(key->parents[i]), rings, n, depth + 1))
+	{
+	  return 1;
+	}
+    }
+
+  return 0;
+}
+
+static int
+possessed(const struct sim_key *key)
+{
+  key_serial_t rings[] = { thread_keyring, process_keyring, session_keyring };
+
+  return descends_from(key, rings, sizeof(rings) / sizeof(rings[0]), 0);
+}
+
+/* Returns 0 if the caller holds all of the permission bits in want,
+   given as KEY_USR_* bits. */
+static int
+check_perm(const struct sim_key *key, key_perm_t want)
+{
+  key_perm_t have = 0;
+
+  if(possessed(key))
+    {
+      have |= (key->perm >> 24) & 0x3f;
+    }
+
+  if(key->uid == getuid())
+    {
+      have |= (key->perm >> 16) & 0x3f;
+    }
+  else if(key->gid == getgid())
+    {
+      have |= (key->perm >> 8) & 0x3f;
+    }
+  else
+    {
+      have |= key->perm & 0x3f;
+    }
+
+  return ((want >> 16) & ~have) ? EACCES : 0;
+}
+
+/* Checks a KEYCTL_RESTRICT_KEYRING type and restriction as the
+   asymmetric key type would. A null type, with no restriction, is a
+   keyring closed to new links. */
+static int
+restriction_valid(const char *type, const char *restriction)
+{
+  const char *rest;
+  char *end;
+  long serial;
+
+  if(type == NULL)
+    {
+      return restriction ? EINVAL : 0;
+    }
+
+  if(strcmp(type, "asymmetric"))
+    {
+      return ENOENT;
+    }
+
+  if(restriction == NULL)
+    {
+      return EINVAL;
+    }
+
+  if(strcmp(restriction, "builtin_trusted") == 0
+     || strcmp(restriction, "builtin_and_secondary_trusted") == 0)
+    {
+      return 0;
+    }
+
+  if(strncmp(restriction, "key_or_keyring:", 15))
+    {
+      return EINVAL;
+    }
+
+  rest = restriction + 15;
+  serial = strtol(rest, &end, 0);
+
+  if(end == rest || (*end && strcmp(end, ":chain")))
+    {
+      return EINVAL;
+    }
+
+  /* 0 stands for the restricted keyring itself. */
+  if(serial && find_key((key_serial_t)serial) == NULL)
+    {
+      return ENOKEY;
+    }
+
+  return 0;
+}
+
+static key_serial_t
+default_keyring(void)
+{
+  switch(reqkey_defl)
+    {
+    case KEY_REQKEY_DEFL_THREAD_KEYRING:
+      return resolve(KEY_SPEC_THREAD_KEYRING, 1);
+    case KEY_REQKEY_DEFL_PROCESS_KEYRING:
+      return resolve(KEY_SPEC_PROCESS_KEYRING, 1);
+    case KEY_REQKEY_DEFL_USER_KEYRING:
+      return resolve(KEY_SPEC_USER_KEYRING, 1);
+    case KEY_REQKEY_DEFL_USER_SESSION_KEYRING:
+      return resolve(KEY_SPEC_USER_SESSION_KEYRING, 1);
+    default:
+      return resolve(KEY_SPEC_SESSION_KEYRING, 1);
+    }
+}
+
+
+
+/* ******************************************************************
+   Entry points
+*/
+
+#define FAIL(e) do { errno = (e); result = -1; goto out; } while(0)
+
+key_serial_t
+add_key(const char *type, const char *description, const void *payload,
+	size_t plen, key_serial_t ringid)
+{
+  struct sim_key *ring;
+  struct sim_key *key = NULL;
+  long result = -1;
+  int error;
+  size_t i;
+
+  sim_lock_enter();
+
+  if((error = injected_fault("add_key")))
+    {
+      FAIL(error);
+    }
+
+  if(type == NULL || description == NULL || type[0] == '.')
+    {
+      FAIL(EINVAL);
+    }
+
+  if(strcmp(type, "keyring") == 0 && plen)
+    {
+      FAIL(EINVAL);
+    }
+
+  if(strcmp(type, "user") && strcmp(type, "logon") && strcmp(type, "keyring")
+     && strcmp(type, "asymmetric"))
+    {
+      FAIL(ENODEV);
+    }
+
+  if((ring = lookup(ringid, 1)) == NULL)
+    {
+      goto out;
+    }
+
+  if(!is_keyring(ring))
+    {
+      FAIL(ENOTDIR);
+    }
+
+  if((error = key_usable(ring)) || (error = check_perm(ring, KEY_USR_WRITE))
+     || (error = link_permitted(ring, type)))
+    {
+      FAIL(error);
+    }
+
+  /* Keys with an update operation are updated in place. */
+  if(strcmp(type, "keyring") != 0)
+    {
+      for(i = 0; i < ring->nlinks; i++)
+	{
+	  struct sim_key *old = find_key(ring->links[i]);
+
+	  if(old && strcmp(old->type, type) == 0
+	     && strcmp(old->description, description) == 0
+	     && !key_usable(old))
+	    {
+	      key = old;
+	      break;
+	    }
+	}
+    }
+
+  if(key)
+    {
+      if((error = check_perm(key, KEY_USR_WRITE)) || (error = set_payload(key, payload, plen)))
+	{
+	  FAIL(error);
+	}
+    }
+  else
+    {
+      if((key = new_key(type, description, payload, plen)) == NULL)
+	{
+	  goto out;
+	}
+
+      /* A new keyring displaces one of the same name. */
+      for(i = 0; i < ring->nlinks; i++)
+	{
+	  struct sim_key *old = find_key(ring->links[i]);
+
+	  if(old && strcmp(old->type, type) == 0
+	     && strcmp(old->description, description) == 0)
+	    {
+	      unlink_key(ring, old->serial);
+	      break;
+	    }
+	}
+
+      if((error = link_key(ring, key->serial)))
+	{
+	  destroy_key(key);
+	  FAIL(error);
+	}
+    }
+
+  result = key->serial;
+
+ out:
+  sim_lock_leave();
+
+  return result;
+}
+
+key_serial_t
+request_key(const char *type, const char *description,
+	    const char *callout_info, key_serial_t destringid)
+{
+  struct sim_key *key;
+  struct sim_key *dest = NULL;
+  key_serial_t serial;
+  key_serial_t constructing = 0;
+  long result = -1;
+  int error;
+
+  sim_lock_enter();
+
+  if((error = injected_fault("request_key")))
+    {
+      FAIL(error);
+    }
+
+  if(type == NULL || description == NULL)
+    {
+      FAIL(EINVAL);
+    }
+
+  if(destringid)
+    {
+      dest = lookup(destringid, 1);
+    }
+  else
+    {
+      serial = default_keyring();
+      dest = serial < 0 ? NULL : find_key(serial);
+    }
+
+  if(dest == NULL)
+    {
+      goto out;
+    }
+
+  /* A key under construction is linked into its requester's
+     destination, which is also where the kernel looks for one before
+     starting a second upcall. */
+  if((key = search_process_keyrings(type, description)) == NULL)
+    {
+      key = search_tree(dest, type, description, 0);
+    }
+
+  /* Another thread's upcall is constructing the key: wait for it. */
+  while(key && !key->instantiated)
+    {
+      serial = key->serial;
+      pthread_cond_wait(&sim_constructed, &sim_lock);
+      key = find_key(serial);
+    }
+
+  if(key == NULL)
+    {
+      /* Upcall: construct the key without holding the lock, as the
+	 kernel would while request-key runs. */
+      if((key = new_key(type, description, NULL, 0)) == NULL)
+	{
+	  goto out;
+	}
+
+      key->instantiated = 0;
+      serial = key->serial;
+
+      if((error = link_key(dest, serial)))
+	{
+	  destroy_key(key);
+	  FAIL(error);
+	}
+
+      /* Held until this call is done with it, even if unlinked. */
+      key->pinned++;
+      constructing = serial;
+
+      __atomic_fetch_add(&upcall_count, 1, __ATOMIC_RELAXED);
+
+      pthread_mutex_unlock(&sim_lock);
+
+      if(upcall_ns > 0)
+	{
+	  struct timespec delay = { upcall_ns / 1000000000L, upcall_ns % 1000000000L };
+
+	  nanosleep(&delay, NULL);
+	}
+
+      pthread_mutex_lock(&sim_lock);
+
+      if((key = find_key(serial)) == NULL)
+	{
+	  FAIL(ENOKEY);
+	}
+
+      if(!key->instantiated)
+	{
+	  if(callout_info && (error = set_payload(key, callout_info, strlen(callout_info))))
+	    {
+	      FAIL(error);
+	    }
+
+	  key->negative_error = callout_info ? 0 : ENOKEY;
+	  key->instantiated = 1;
+	  pthread_cond_broadcast(&sim_constructed);
+	}
+    }
+
+  if((error = key_usable(key)))
+    {
+      FAIL(error);
+    }
+
+  if((error = link_key(dest, key->serial)))
+    {
+      FAIL(error);
+    }
+
+  result = key->serial;
+
+ out:
+  if(constructing && (key = find_key(constructing)))
+    {
+      key->pinned--;
+      release_key(key);
+    }
+
+  sim_lock_leave();
+
+  return result;
+}
+
+static long
+read_out(const void *data, size_t len, char *buffer, size_t buflen)
+{
+  if(buffer && buflen)
+    {
+      memcpy(buffer, data, len < buflen ? len : buflen);
+    }
+
+  return len;
+}
+
+long
+keyctl(int cmd, ...)
+{
+  unsigned long arg2, arg3, arg4, arg5;
+  struct sim_key *key = NULL;
+  struct sim_key *ring = NULL;
+  char text[512];
+  long result = 0;
+  int error;
+  va_list ap;
+
+  va_start(ap, cmd);
+  arg2 = va_arg(ap, unsigned long);
+  arg3 = va_arg(ap, unsigned long);
+  arg4 = va_arg(ap, unsigned long);
+  arg5 = va_arg(ap, unsigned long);
+  va_end(ap);
+
+  sim_lock_enter();
+
+  if(cmd >= 0 && (size_t)cmd < N_KEYCTL_NAMES
+     && (error = injected_fault(keyctl_names[cmd])))
+    {
+      FAIL(error);
+    }
+
+  switch(cmd)
+    {
+    case KEYCTL_GET_KEYRING_ID:
+      result = resolve((key_serial_t)arg2, (int)arg3);
+      break;
+
+    case KEYCTL_JOIN_SESSION_KEYRING:
+      {
+	const char *name = (const char *)arg2;
+
+	key = NULL;
+
+	if(name)
+	  {
+	    for(key = sim_keys; key; key = key->next)
+	      {
+		if(is_keyring(key) && strcmp(key->description, name) == 0)
+		  {
+		    break;
+		  }
+	      }
+	  }
+
+	if(key == NULL && (key = new_key("keyring", name ? name : "_ses", NULL, 0)) == NULL)
+	  {
+	    result = -1;
+	    break;
+	  }
+
+	/* The new session keyring is pinned before the old one is
+	   released, which may be the same keyring. */
+	key->pinned++;
+
+	if(session_keyring && (ring = find_key(session_keyring)))
+	  {
+	    ring->pinned--;
+	    release_key(ring);
+	  }
+
+	session_keyring = key->serial;
+	result = key->serial;
+      }
+      break;
+
+    case KEYCTL_UPDATE:
+      if((key = lookup((key_serial_t)arg2, 0)) == NULL)
+	{
+	  result = -1;
+	}
+      else if(is_keyring(key))
+	{
+	  FAIL(EOPNOTSUPP);
+	}
+      else if((error = key_usable(key)) || (error = check_perm(key, KEY_USR_WRITE))
+	      || (error = set_payload(key, (const void *)arg3, (size_t)arg4)))
+	{
+	  FAIL(error);
+	}
+      break;
+
+    case KEYCTL_REVOKE:
+      if((key = lookup((key_serial_t)arg2, 0)) == NULL)
+	{
+	  result = -1;
+	}
+      else if((error = check_perm(key, KEY_USR_WRITE))
+	      && (error = check_perm(key, KEY_USR_SETATTR)))
+	{
+	  FAIL(error);
+	}
+      else
+	{
+	  key->revoked = 1;
+	}
+      break;
+
+    case KEYCTL_CHOWN:
+      if((key = lookup((key_serial_t)arg2, 0)) == NULL)
+	{
+	  result = -1;
+	}
+      else if((error = check_perm(key, KEY_USR_SETATTR)))
+	{
+	  FAIL(error);
+	}
+      else
+	{
+	  if((uid_t)arg3 != (uid_t)-1)
+	    {
+	      if(getuid() != 0 && (uid_t)arg3 != key->uid)
+		{
+		  FAIL(EACCES);
+		}
+
+	      key->uid = (uid_t)arg3;
+	    }
+
+	  if((gid_t)arg4 != (gid_t)-1)
+	    {
+	      key->gid = (gid_t)arg4;
+	    }
+	}
+      break;
+
+    case KEYCTL_SETPERM:
+      if((key = lookup((key_serial_t)arg2, 0)) == NULL)
+	{
+	  result = -1;
+	}
+      else if((error = check_perm(key, KEY_USR_SETATTR)))
+	{
+	  FAIL(error);
+	}
+      else
+	{
+	  key->perm = (key_perm_t)arg3;
+	}
+      break;
+
+    case KEYCTL_DESCRIBE:
+      if((key = lookup((key_serial_t)arg2, 0)) == NULL)
+	{
+	  result = -1;
+	}
+      else if((error = check_perm(key, KEY_USR_VIEW)))
+	{
+	  FAIL(error);
+	}
+      else
+	{
+	  int len = snprintf(text, sizeof(text), "%s;%d;%d;%08x;%s",
+			     key->type, (int)key->uid, (int)key->gid,
+			     (unsigned)key->perm, key->description);
+
+	  result = read_out(text, (size_t)len + 1, (char *)arg3, (size_t)arg4);
+	}
+      break;
+
+    case KEYCTL_CLEAR:
+      if((ring = lookup((key_serial_t)arg2, 0)) == NULL)
+	{
+	  result = -1;
+	}
+      else if(!is_keyring(ring))
+	{
+	  FAIL(ENOTDIR);
+	}
+      else if((error = check_perm(ring, KEY_USR_WRITE)))
+	{
+	  FAIL(error);
+	}
+      else
+	{
+	  while(ring->nlinks)
+	    {
+	      unlink_key(ring, ring->links[ring->nlinks - 1]);
+	    }
+	}
+      break;
+
+    case KEYCTL_LINK:
+    case KEYCTL_UNLINK:
+      if((ring = lookup((key_serial_t)arg2, 0)) == NULL
+	 || (key = lookup((key_serial_t)arg3, 0)) == NULL)
+	{
+	  result = -1;
+	}
+      else if(!is_keyring(ring))
+	{
+	  FAIL(ENOTDIR);
+	}
+      else if((error = check_perm(ring, KEY_USR_WRITE)))
+	{
+	  FAIL(error);
+	}
+      else if(cmd == KEYCTL_LINK)
+	{
+	  /* Whether key is ring, or holds it. */
+	  if(descends_from(ring, &key->serial, 1, 0))
+	    {
+	      FAIL(EDEADLK);
+	    }
+
+	  if((error = key_usable(key)) || (error = check_perm(key, KEY_USR_LINK))
+	     || (error = link_key(ring, key->serial)))
+	    {
+	      FAIL(error);
+	    }
+	}
+      else if(!unlink_key(ring, key->serial))
+	{
+	  FAIL(ENOENT);
+	}
+      break;
+
+    case KEYCTL_SEARCH:
+      if((ring = lookup((key_serial_t)arg2, 0)) == NULL)
+	{
+	  result = -1;
+	}
+      else if(!is_keyring(ring))
+	{
+	  FAIL(ENOTDIR);
+	}
+      else if((error = check_perm(ring, KEY_USR_SEARCH)))
+	{
+	  FAIL(error);
+	}
+      else if((key = search_tree(ring, (const char *)arg3, (const char *)arg4, 0)) == NULL)
+	{
+	  FAIL(ENOKEY);
+	}
+      else if((error = key_usable(key)))
+	{
+	  FAIL(error);
+	}
+      else
+	{
+	  if((key_serial_t)arg5)
+	    {
+	      struct sim_key *dest = lookup((key_serial_t)arg5, 1);
+
+	      if(dest == NULL)
+		{
+		  result = -1;
+		  break;
+		}
+
+	      if((error = link_key(dest, key->serial)))
+		{
+		  FAIL(error);
+		}
+	    }
+
+	  result = key->serial;
+	}
+      break;
+
+    case KEYCTL_READ:
+      if((key = lookup((key_serial_t)arg2, 0)) == NULL)
+	{
+	  result = -1;
+	}
+      else if((error = key_usable(key)) || (error = check_perm(key, KEY_USR_READ)))
+	{
+	  FAIL(error);
+	}
+      else if(strcmp(key->type, "logon") == 0)
+	{
+	  FAIL(EOPNOTSUPP);
+	}
+      else if(is_keyring(key))
+	{
+	  result = read_out(key->links, key->nlinks * sizeof(key_serial_t),
+			    (char *)arg3, (size_t)arg4);
+	}
+      else
+	{
+	  result = read_out(key->payload, key->plen, (char *)arg3, (size_t)arg4);
+	}
+      break;
+
+    case KEYCTL_INSTANTIATE:
+    case KEYCTL_NEGATE:
+    case KEYCTL_REJECT:
+      if((key = lookup((key_serial_t)arg2, 0)) == NULL)
+	{
+	  result = -1;
+	}
+      else if(key->instantiated)
+	{
+	  FAIL(EPERM);
+	}
+      else
+	{
+	  key_serial_t dest = (key_serial_t)(cmd == KEYCTL_INSTANTIATE ? arg5
+					     : cmd == KEYCTL_NEGATE ? arg4 : arg5);
+
+	  if(cmd == KEYCTL_INSTANTIATE)
+	    {
+	      if((error = set_payload(key, (const void *)arg3, (size_t)arg4)))
+		{
+		  FAIL(error);
+		}
+	    }
+	  else
+	    {
+	      unsigned timeout = (unsigned)arg3;
+
+	      key->negative_error = cmd == KEYCTL_NEGATE ? ENOKEY : (int)arg4;
+	      key->expiry = timeout ? time(NULL) + timeout : 0;
+	    }
+
+	  key->instantiated = 1;
+	  pthread_cond_broadcast(&sim_constructed);
+
+	  if(dest && (ring = lookup(dest, 1)) && (error = link_key(ring, key->serial)))
+	    {
+	      FAIL(error);
+	    }
+	}
+      break;
+
+    case KEYCTL_SET_REQKEY_KEYRING:
+      result = reqkey_defl;
+
+      if((int)arg2 != KEY_REQKEY_DEFL_NO_CHANGE)
+	{
+	  reqkey_defl = (int)arg2;
+	}
+      break;
+
+    case KEYCTL_SET_TIMEOUT:
+      if((key = lookup((key_serial_t)arg2, 0)) == NULL)
+	{
+	  result = -1;
+	}
+      else if((error = check_perm(key, KEY_USR_SETATTR)))
+	{
+	  FAIL(error);
+	}
+      else
+	{
+	  key->expiry = (unsigned)arg3 ? time(NULL) + (unsigned)arg3 : 0;
+	}
+      break;
+
+    case KEYCTL_ASSUME_AUTHORITY:
+    case KEYCTL_SESSION_TO_PARENT:
+      break;
+
+    case KEYCTL_GET_SECURITY:
+      if((key = lookup((key_serial_t)arg2, 0)) == NULL)
+	{
+	  result = -1;
+	}
+      else
+	{
+	  result = read_out("", 1, (char *)arg3, (size_t)arg4);
+	}
+      break;
+
+    case KEYCTL_INVALIDATE:
+      if((key = lookup((key_serial_t)arg2, 0)) == NULL)
+	{
+	  result = -1;
+	}
+      else if((error = check_perm(key, KEY_USR_SEARCH)))
+	{
+	  FAIL(error);
+	}
+      else
+	{
+	  destroy_key(key);
+	}
+      break;
+
+    case KEYCTL_GET_PERSISTENT:
+      /* Only the caller's own, as if without CAP_SETUID. */
+      if((uid_t)arg2 != (uid_t)-1 && (uid_t)arg2 != getuid())
+	{
+	  FAIL(EPERM);
+	}
+
+      if((ring = lookup((key_serial_t)arg3, 1)) == NULL
+	 || special_keyring(&persistent_keyring, "_persistent") < 0
+	 || (key = find_key(persistent_keyring)) == NULL)
+	{
+	  result = -1;
+	}
+      else if(!is_keyring(ring))
+	{
+	  FAIL(ENOTDIR);
+	}
+      else if((error = check_perm(ring, KEY_USR_WRITE))
+	      || (error = link_key(ring, key->serial)))
+	{
+	  FAIL(error);
+	}
+      else
+	{
+	  result = key->serial;
+	}
+      break;
+
+    case KEYCTL_RESTRICT_KEYRING:
+      if((ring = lookup((key_serial_t)arg2, 0)) == NULL)
+	{
+	  result = -1;
+	}
+      else if(!is_keyring(ring))
+	{
+	  FAIL(ENOTDIR);
+	}
+      else if((error = check_perm(ring, KEY_USR_SETATTR)))
+	{
+	  FAIL(error);
+	}
+      else if(ring->restricted)
+	{
+	  FAIL(EEXIST);
+	}
+      else if((error = restriction_valid((const char *)arg3, (const char *)arg4)))
+	{
+	  FAIL(error);
+	}
+      else
+	{
+	  ring->restricted = 1;
+
+	  if(arg3)
+	    {
+	      strncpy(ring->restrict_type, (const char *)arg3,
+		      sizeof(ring->restrict_type) - 1);
+	    }
+	}
+      break;
+
+    default:
+      FAIL(EOPNOTSUPP);
+    }
+
+ out:
+  sim_lock_leave();
+
+  return result;
+}
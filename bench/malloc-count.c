@@ -0,0 +1,196 @@
+/* Copyright (C) 2016 Kirk Zurell.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/* malloc-count: counts calls to malloc, calloc and realloc.
+
+   Linked into the C benchmark, and LD_PRELOADed under Guile, where
+   bench/bindings.scm reads the count through lkr_bench_malloc_count.
+   The keyutils simulator pauses counting while it runs, so that only
+   the callers' allocations are counted.
+*/
+
+#define _GNU_SOURCE
+
+#include <dlfcn.h>
+#include <stddef.h>
+#include <string.h>
+
+static unsigned long malloc_count;
+static __thread int paused;
+
+static void *(*real_malloc)(size_t);
+static void *(*real_calloc)(size_t, size_t);
+static void *(*real_realloc)(void *, size_t);
+static void (*real_free)(void *);
+
+/* dlsym may itself allocate before the real functions are known. */
+static char bootstrap[4096];
+static size_t bootstrap_used;
+
+unsigned long
+lkr_bench_malloc_count(void)
+{
+  return __atomic_load_n(&malloc_count, __ATOMIC_RELAXED);
+}
+
+/* Stops counting this thread's calls while pause is non-zero; see
+   bench/keyutils-sim.c. */
+void
+lkr_bench_malloc_pause(int pause)
+{
+  paused = pause;
+}
+
+static void
+count(void)
+{
+  if(!paused)
+    {
+      __atomic_fetch_add(&malloc_count, 1, __ATOMIC_RELAXED);
+    }
+}
+
+static int
+from_bootstrap(const void *p)
+{
+  return (const char *)p >= bootstrap && (const char *)p < bootstrap + sizeof(bootstrap);
+}
+
+/* Serve an allocation made while resolving from the bootstrap buffer,
+   which is never freed. Each block is preceded by its size, for
+   realloc. */
+static void *
+bootstrap_alloc(size_t size)
+{
+  size_t len = (size + 15) & ~(size_t)15;
+  char *p = bootstrap + bootstrap_used;
+
+  if(bootstrap_used + 16 + len > sizeof(bootstrap))
+    {
+      return NULL;
+    }
+
+  /* Static storage is already zero. */
+  bootstrap_used += 16 + len;
+  *(size_t *)p = size;
+
+  return p + 16;
+}
+
+static void
+resolve(void)
+{
+  static int resolving;
+
+  if(resolving)
+    {
+      return;
+    }
+
+  resolving = 1;
+  real_malloc = dlsym(RTLD_NEXT, "malloc");
+  real_calloc = dlsym(RTLD_NEXT, "calloc");
+  real_realloc = dlsym(RTLD_NEXT, "realloc");
+  real_free = dlsym(RTLD_NEXT, "free");
+  resolving = 0;
+}
+
+void *
+malloc(size_t size)
+{
+  if(real_malloc == NULL)
+    {
+      resolve();
+
+      if(real_malloc == NULL)
+	{
+	  return bootstrap_alloc(size);
+	}
+    }
+
+  count();
+
+  return real_malloc(size);
+}
+
+void *
+calloc(size_t n, size_t size)
+{
+  if(real_calloc == NULL)
+    {
+      resolve();
+
+      if(real_calloc == NULL)
+	{
+	  if(size && n > (size_t)-1 / size)
+	    {
+	      return NULL;
+	    }
+
+	  return bootstrap_alloc(n * size);
+	}
+    }
+
+  count();
+
+  return real_calloc(n, size);
+}
+
+void *
+realloc(void *p, size_t size)
+{
+  if(real_realloc == NULL)
+    {
+      resolve();
+    }
+
+  /* A bootstrap block moves to the bootstrap buffer again, or to the
+     real heap once there is one, and the old copy is left behind. */
+  if(real_realloc == NULL || from_bootstrap(p))
+    {
+      void *q = real_malloc ? malloc(size) : bootstrap_alloc(size);
+      size_t old = p ? *(size_t *)((char *)p - 16) : 0;
+
+      if(q && p)
+	{
+	  memcpy(q, p, old < size ? old : size);
+	}
+
+      return q;
+    }
+
+  count();
+
+  return real_realloc(p, size);
+}
+
+void
+free(void *p)
+{
+  if(from_bootstrap(p))
+    {
+      return;
+    }
+
+  if(real_free == NULL)
+    {
+      resolve();
+    }
+
+  real_free(p);
+}
@@ -0,0 +1,78 @@
+ ;; Copyright (C) 2016 Kirk Zurell.
+
+ ;; guile-linux-key-retention is free software; you can redistribute
+ ;; it and/or modify it under the terms of the GNU Lesser General
+ ;; Public License as published by the Free Software Foundation;
+ ;; either version 3 of the License, or (at your option) any later
+ ;; version.
+
+ ;; This library is distributed in the hope that it will be useful, but
+ ;; WITHOUT ANY WARRANTY; without even the implied warranty of
+ ;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ ;; Lesser General Public License for more details.
+
+ ;; You should have received a copy of the GNU Lesser General Public
+ ;; License along with this library; if not, write to the Free Software
+ ;; Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ ;; 02110-1301 USA
+
+;;; Upcalls avoided by the persistent keyring, under bench/keyutils-sim.
+;;;
+;;; Starts LKR_BENCH_SESSIONS new session keyrings in a row, as a batch
+;;; job run from cron would, and requests LKR_BENCH_CREDENTIALS keys in
+;;; each. The "session" rows keep the keys in the session keyring, so
+;;; every session makes every upcall again; the "persistent" rows keep
+;;; them in the persistent keyring, joined at the start of each
+;;; session. Upcalls are counted by the simulator.
+
+(use-modules (system foreign)
+             (linux-key-retention guile-linux-key-retention))
+
+(define sessions
+  (or (and=> (getenv "LKR_BENCH_SESSIONS") string->number) 20))
+
+(define credentials
+  (or (and=> (getenv "LKR_BENCH_CREDENTIALS") string->number) 8))
+
+(define upcall-count
+  (catch #t
+    (lambda ()
+      (pointer->procedure unsigned-long
+                          (dynamic-func "lkr_sim_upcall_count"
+                                        (dynamic-link))
+                          '()))
+    (lambda _
+      (format (current-error-port)
+              "persistent.scm: needs bench/keyutils-sim preloaded~%")
+      (exit 1))))
+
+(define (now-ns)
+  (let ((t (gettimeofday)))
+    (* 1000 (+ (* 1000000 (car t)) (cdr t)))))
+
+(define (credential i)
+  (string-append "lkr-bench:credential:" (number->string i)))
+
+(define (run mode start-session)
+  (let ((upcalls (upcall-count))
+        (start (now-ns)))
+    (let loop ((s 0))
+      (when (< s sessions)
+        (keyctl-join-session-keyring)
+        (let ((dest (start-session)))
+          (let request ((i 0))
+            (when (< i credentials)
+              (request-key "user" (credential i) "secret" dest)
+              (request (1+ i)))))
+        (loop (1+ s))))
+    (let ((elapsed (- (now-ns) start))
+          (upcalls (- (upcall-count) upcalls)))
+      (format #t "~a\t~a\t~a\t~a\t~a\t~a~%"
+              mode sessions credentials upcalls
+              (- (* sessions credentials) upcalls)
+              (quotient elapsed sessions)))))
+
+(format #t "# mode\tsessions\tcredentials\tupcalls\tupcalls_avoided\tns_per_session~%")
+
+(run "session" (lambda () KEY_SPEC_SESSION_KEYRING))
+(run "persistent" join-persistent-keyring)
@@ -0,0 +1,7 @@
+;; Upcall provider for the benchmarks: instantiate every lkr-bench key
+;; with its callout information.
+(use-modules (linux-key-retention upcall))
+
+(register-upcall-handler! "user" "lkr-bench:*"
+  (lambda (upcall)
+    (upcall-callout-info upcall)))
@@ -0,0 +1,132 @@
+ ;; Copyright (C) 2016 Kirk Zurell.
+
+ ;; guile-linux-key-retention is free software; you can redistribute
+ ;; it and/or modify it under the terms of the GNU Lesser General
+ ;; Public License as published by the Free Software Foundation;
+ ;; either version 3 of the License, or (at your option) any later
+ ;; version.
+
+ ;; This library is distributed in the hope that it will be useful, but
+ ;; WITHOUT ANY WARRANTY; without even the implied warranty of
+ ;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ ;; Lesser General Public License for more details.
+
+ ;; You should have received a copy of the GNU Lesser General Public
+ ;; License along with this library; if not, write to the Free Software
+ ;; Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ ;; 02110-1301 USA
+
+;;; Lookup-and-verify in a shared keyring, with and without a link
+;;; restriction, under bench/keyutils-sim.
+;;;
+;;; LKR_BENCH_TENANTS tenants each have a key in a shared keyring. The
+;;; "describe" rows find a tenant's key and then check its description
+;;; in Scheme before trusting it, as for a keyring anyone may write
+;;; into. The "restricted" rows keep the keys in a keyring made by
+;;; make-trust-keyring, whose restriction was checked when each key was
+;;; linked, so finding the key is enough. Key calls are counted from
+;;; key-retention-stats. The "refused" column counts the untrusted keys
+;;; the keyring turned away at link time, out of one per tenant.
+;;;
+;;; The simulator has asymmetric keys but does not check signatures;
+;;; under the kernel the keys would need to be real certificates.
+
+(use-modules (srfi srfi-1)
+             (system foreign)
+             (linux-key-retention guile-linux-key-retention))
+
+(define iterations
+  (or (and=> (getenv "LKR_BENCH_ITERATIONS") string->number) 10000))
+
+(define tenants
+  (or (and=> (getenv "LKR_BENCH_TENANTS") string->number) 16))
+
+(catch #t
+  (lambda ()
+    (dynamic-func "lkr_sim_upcall_count" (dynamic-link)))
+  (lambda _
+    (format (current-error-port)
+            "restrict.scm: needs bench/keyutils-sim preloaded~%")
+    (exit 1)))
+
+(define (now-ns)
+  (let ((t (gettimeofday)))
+    (* 1000 (+ (* 1000000 (car t)) (cdr t)))))
+
+(define (key-calls)
+  (fold (lambda (op sum) (+ sum (cadr op)))
+        0
+        (assq-ref (key-retention-stats) 'calls)))
+
+(define (tenant i)
+  (string-append "lkr-bench:tenant:" (number->string i)))
+
+(define uid (getuid))
+
+;; "type;uid;gid;perm;description"
+(define (trusted? description type name)
+  (let ((fields (string-split description #\;)))
+    (and (= (length fields) 5)
+         (string=? (first fields) type)
+         (eqv? (string->number (second fields)) uid)
+         (zero? (logand (string->number (fourth fields) 16)
+                        (logior KEY_GRP_WRITE KEY_OTH_WRITE)))
+         (string=? (fifth fields) name))))
+
+(define (refused ring)
+  (let loop ((i 0) (n 0))
+    (if (= i tenants)
+        n
+        (loop (1+ i)
+              (catch 'system-error
+                (lambda ()
+                  (add-key "user" (string-append (tenant i) ":forged")
+                           "forged" ring)
+                  n)
+                (lambda _
+                  (1+ n)))))))
+
+(define (run mode ring lookup)
+  (let ((refused (refused ring))
+        (calls (key-calls))
+        (start (now-ns)))
+    (let loop ((i 0))
+      (when (< i iterations)
+        (unless (lookup ring (tenant (modulo i tenants)))
+          (error "lookup failed" mode i))
+        (loop (1+ i))))
+    (let ((elapsed (- (now-ns) start))
+          (calls (- (key-calls) calls)))
+      (format #t "~a\t~a\t~a\t~a\t~a\t~a~%"
+              mode tenants iterations
+              (exact->inexact (/ elapsed iterations))
+              (exact->inexact (/ calls iterations))
+              refused))))
+
+(define shared
+  (add-key "keyring" "lkr-bench:shared" #f KEY_SPEC_PROCESS_KEYRING))
+
+(define ca
+  (add-key "keyring" "lkr-bench:ca" #f KEY_SPEC_PROCESS_KEYRING))
+
+(define trust
+  (make-trust-keyring "lkr-bench:trust" ca))
+
+(do ((i 0 (1+ i))) ((= i tenants))
+  (add-key "user" (tenant i) "secret" shared)
+  (add-key "asymmetric" (tenant i) "certificate" trust))
+
+(format #t "# mode\ttenants\tlookups\tns_per_lookup\tkey_calls_per_lookup\trefused~%")
+
+(run "describe" shared
+     (lambda (ring name)
+       (let ((key (keyctl-search ring "user" name)))
+         (and (trusted? (keyctl-describe key) "user" name)
+              key))))
+
+(run "restricted" trust
+     (lambda (ring name)
+       (keyctl-search ring "asymmetric" name)))
+
+(keyctl-clear shared)
+(keyctl-unlink KEY_SPEC_PROCESS_KEYRING trust)
@@ -0,0 +1,159 @@
+ ;; Copyright (C) 2016 Kirk Zurell.
+
+ ;; guile-linux-key-retention is free software; you can redistribute
+ ;; it and/or modify it under the terms of the GNU Lesser General
+ ;; Public License as published by the Free Software Foundation;
+ ;; either version 3 of the License, or (at your option) any later
+ ;; version.
+
+ ;; This library is distributed in the hope that it will be useful, but
+ ;; WITHOUT ANY WARRANTY; without even the implied warranty of
+ ;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ ;; Lesser General Public License for more details.
+
+ ;; You should have received a copy of the GNU Lesser General Public
+ ;; License along with this library; if not, write to the Free Software
+ ;; Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ ;; 02110-1301 USA
+
+;;; Contention stress: how the wrappers scale across Guile threads.
+;;;
+;;; For each thread count, every thread makes LKR_STRESS_OPS calls
+;;; drawn from the operation mix, against the shared keyring or its
+;;; own. One tab-separated line is printed per thread count, with the
+;;; throughput and the p50, p99 and p99.9 latencies, so that runs can
+;;; be diffed between releases.
+;;;
+;;; Environment:
+;;;
+;;; LKR_STRESS_THREADS  Thread counts, e.g. "1 2 4 8". Defaults to
+;;;                     every count from 1 to the number of cores.
+;;; LKR_STRESS_OPS      Calls per thread (default 20000).
+;;; LKR_STRESS_MIX      Weights, e.g. "search=40,read=40,update=10,link=10".
+;;; LKR_STRESS_SHARED   Percentage of calls on the shared keyring
+;;;                     (default 50).
+;;; LKR_STRESS_KEYS     Keys per keyring (default 16).
+
+(use-modules (ice-9 threads)
+             (srfi srfi-1)
+             (linux-key-retention guile-linux-key-retention))
+
+(define (env name default)
+  (or (getenv name) default))
+
+(define (env-number name default)
+  (or (and=> (getenv name) string->number) default))
+
+(define thread-counts
+  (let ((spec (getenv "LKR_STRESS_THREADS")))
+    (if spec
+        (map string->number (string-tokenize spec))
+        (iota (current-processor-count) 1))))
+
+(define ops-per-thread (env-number "LKR_STRESS_OPS" 20000))
+(define shared-percent (env-number "LKR_STRESS_SHARED" 50))
+(define keys-per-keyring (env-number "LKR_STRESS_KEYS" 16))
+
+(define mix-spec (env "LKR_STRESS_MIX" "search=40,read=40,update=10,link=10"))
+
+;; ((name . weight) ...)
+(define mix
+  (map (lambda (entry)
+         (let ((i (string-index entry #\=)))
+           (cons (string->symbol (substring entry 0 i))
+                 (string->number (substring entry (1+ i))))))
+       (string-split mix-spec #\,)))
+
+(define total-weight (apply + (map cdr mix)))
+
+(define (pick-op state)
+  (let loop ((n (random total-weight state)) (mix mix))
+    (if (< n (cdar mix))
+        (caar mix)
+        (loop (- n (cdar mix)) (cdr mix)))))
+
+(define (description i)
+  (string-append "lkr-stress:" (number->string i)))
+
+;; A keyring holding keys-per-keyring user keys, as #(keyring keys scratch).
+;; Links are made in the calling thread's own scratch keyring, even for
+;; keys in the shared keyring, so that no thread unlinks another's link.
+(define (make-stress-keyring name parent)
+  (let ((keyring (add-key "keyring" name #f parent)))
+    (vector keyring
+            (list->vector
+             (map (lambda (i)
+                    (add-key "user" (description i) "payload" keyring))
+                  (iota keys-per-keyring)))
+            (add-key "keyring" (string-append name ":scratch") #f parent))))
+
+(define root (add-key "keyring" "lkr-stress" #f KEY_SPEC_PROCESS_KEYRING))
+(define shared (make-stress-keyring "lkr-stress:shared" root))
+
+;; get-internal-real-time only has millisecond ticks on Guile 2.0.
+(define (now-ns)
+  (let ((t (gettimeofday)))
+    (* 1000 (+ (* 1000000 (car t)) (cdr t)))))
+
+(define (run-op op state ring scratch)
+  (let* ((i (random keys-per-keyring state))
+         (key (vector-ref (vector-ref ring 1) i)))
+    (case op
+      ((search) (keyctl-search (vector-ref ring 0) "user" (description i)))
+      ((read) (keyctl-read key))
+      ((update) (keyctl-update key "payload"))
+      ((link) (keyctl-link scratch key)
+              (keyctl-unlink scratch key))
+      (else (error "Unknown operation:" op)))))
+
+;; Returns a vector of per-call latencies in nanoseconds, to the
+;; microsecond that gettimeofday gives.
+(define (worker n own)
+  (let ((state (seed->random-state n))
+        (latencies (make-vector ops-per-thread 0)))
+    (let loop ((i 0))
+      (when (< i ops-per-thread)
+        (let ((op (pick-op state))
+              (ring (if (< (random 100 state) shared-percent) shared own))
+              (start (now-ns)))
+          (run-op op state ring (vector-ref own 2))
+          (vector-set! latencies i (- (now-ns) start)))
+        (loop (1+ i))))
+    latencies))
+
+(define (percentile sorted p)
+  (let ((n (vector-length sorted)))
+    (vector-ref sorted (min (1- n) (inexact->exact (floor (* n p)))))))
+
+(define (run threads)
+  (let* ((owns (map (lambda (n)
+                      (make-stress-keyring
+                       (string-append "lkr-stress:" (number->string n))
+                       root))
+                    (iota threads)))
+         (start (now-ns))
+         (workers (map (lambda (n own)
+                         (call-with-new-thread (lambda () (worker n own))))
+                       (iota threads) owns))
+         (results (map join-thread workers))
+         (elapsed (- (now-ns) start))
+         (sorted (sort! (list->vector (append-map vector->list results)) <))
+         (ops (vector-length sorted)))
+    (format #t "stress\t~a\t~a\t~a\t~a\t~a\t~a\t~a\t~a~%"
+            mix-spec shared-percent threads ops
+            (inexact->exact (round (/ (* ops 1000000000) elapsed)))
+            (percentile sorted 0.5)
+            (percentile sorted 0.99)
+            (percentile sorted 0.999))
+    (force-output)
+    (for-each (lambda (own)
+                (keyctl-clear (vector-ref own 0))
+                (keyctl-unlink root (vector-ref own 0))
+                (keyctl-unlink root (vector-ref own 2)))
+              owns)))
+
+(format #t "# bench\tmix\tshared_pct\tthreads\tops\tops_per_sec\tp50_ns\tp99_ns\tp999_ns~%")
+
+(for-each run thread-counts)
+
+(keyctl-clear root)
@@ -0,0 +1,162 @@
+/* Copyright (C) 2016 Kirk Zurell.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/* upcall-latency: wall-clock cost of a request-key upcall.
+
+   Each sample is one request_key() for a description nothing has
+   asked for before, timed until it returns with the key instantiated:
+   the kernel exec'ing request-key, request-key exec'ing the handler,
+   the handler starting up, and keyctl-instantiate.
+
+   The handlers are chosen by description prefix; bench/upcall.conf
+   routes "lkr-bench:keyctl:", "lkr-bench:script:" and
+   "lkr-bench:launcher:" to keyctl(1), guile-lkr-upcall and
+   guile-lkr-upcall-launcher.
+
+   Usage: upcall-latency [-n COUNT] PREFIX...
+
+   Prints one tab-separated line per prefix.
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <keyutils.h>
+
+static long long
+now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int
+compare_ll(const void *a, const void *b)
+{
+  long long x = *(const long long *)a;
+  long long y = *(const long long *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+static int
+run(const char *prefix, int count, key_serial_t keyring)
+{
+  long long *samples = calloc(count, sizeof(*samples));
+  long long total = 0;
+  char description[256];
+  int i;
+
+  if(samples == NULL)
+    {
+      perror("calloc");
+      return -1;
+    }
+
+  for(i = 0; i < count; i++)
+    {
+      key_serial_t key;
+      long long start;
+
+      snprintf(description, sizeof(description), "%s%d-%d", prefix, (int)getpid(), i);
+
+      start = now_ns();
+      key = request_key("user", description, "lkr-bench", keyring);
+      samples[i] = now_ns() - start;
+
+      if(key < 0)
+	{
+	  fprintf(stderr, "upcall-latency: request_key %s: %s\n", description, strerror(errno));
+	  free(samples);
+	  return -1;
+	}
+
+      keyctl(KEYCTL_INVALIDATE, key);
+      total += samples[i];
+    }
+
+  qsort(samples, count, sizeof(*samples), compare_ll);
+
+  printf("upcall\t%s\t%d\t%lld\t%lld\t%lld\t%lld\n",
+	 prefix, count,
+	 samples[0],
+	 samples[count / 2],
+	 samples[(count * 99) / 100],
+	 total / count);
+
+  free(samples);
+
+  return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+  key_serial_t keyring;
+  int count = 100;
+  int status = 0;
+  int opt;
+
+  while((opt = getopt(argc, argv, "n:")) != -1)
+    {
+      switch(opt)
+	{
+	case 'n':
+	  count = atoi(optarg);
+	  break;
+	default:
+	  fprintf(stderr, "Usage: %s [-n COUNT] PREFIX...\n", argv[0]);
+	  return 2;
+	}
+    }
+
+  if(optind == argc || count < 1)
+    {
+      fprintf(stderr, "Usage: %s [-n COUNT] PREFIX...\n", argv[0]);
+      return 2;
+    }
+
+  keyring = add_key("keyring", "lkr-bench", NULL, 0, KEY_SPEC_PROCESS_KEYRING);
+
+  if(keyring < 0)
+    {
+      perror("upcall-latency: add_key keyring");
+      return 1;
+    }
+
+  printf("# bench\tprefix\tcount\tmin_ns\tp50_ns\tp99_ns\tmean_ns\n");
+
+  for(; optind < argc; optind++)
+    {
+      if(run(argv[optind], count, keyring) < 0)
+	{
+	  status = 1;
+	}
+    }
+
+  keyctl(KEYCTL_CLEAR, keyring);
+
+  return status;
+}
@@ -0,0 +1,778 @@
+/* Copyright (C) 2016 Kirk Zurell.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/* guile-linux-key-retention: key records.
+
+   A key record is an alist of named, typed fields in a compact binary
+   form, for instantiate payloads and request-key callout information,
+   so that upcall handlers neither format nor parse key=value text.
+   Records are encoded straight from the alist into a staging buffer
+   (see arena.c), strings as UTF-8 character by character, and decoded
+   straight from the bytes into the alist. Field names go through a
+   small cache of symbols and their UTF-8 forms, so that a name seen
+   before is neither converted to a string nor interned again.
+
+   Version 1 is a version byte followed by the fields, each
+
+     a tag byte, giving the value's type;
+     the name, as a varint length and that many UTF-8 bytes;
+     the value: for INT, a zigzag varint; for BYTES and STRING, a
+       varint length and that many bytes, UTF-8 for STRING; nothing
+       for FALSE and TRUE.
+
+   Varints are unsigned LEB128, so integers are limited to 64 bits.
+   A decoder refuses versions it does not know, so fields are only
+   ever added under a new version.
+
+   Callout information reaches the upcall handler on its command line,
+   where a zero byte would end it and the locale may mangle others, so
+   there the record is armoured as unpadded base64url.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libguile.h>
+
+#include "arena.h"
+#include "codec.h"
+
+#define KEY_RECORD_DESC "ALIST of SYMBOL to INTEGER, STRING, BYTEVECTOR or BOOL"
+
+#define KEY_RECORD_VERSION 1
+
+enum key_record_tag
+  {
+    KEY_RECORD_INT,
+    KEY_RECORD_BYTES,
+    KEY_RECORD_STRING,
+    KEY_RECORD_FALSE,
+    KEY_RECORD_TRUE
+  };
+
+static const char armour_chars[] =
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+/* Entries in each of the field name caches. */
+#define NAME_CACHE_SIZE 64
+
+/* (symbol . UTF-8 bytevector) pairs, indexed by the symbol's hash and
+   by the bytes' hash. Pairs are replaced, never changed, so a racing
+   reader sees either the old pair or the new one. */
+static SCM names_by_symbol;
+static SCM names_by_bytes;
+
+
+/* ******************************************************************
+   Output buffers
+*/
+
+/* A staging buffer written from the front. used is kept equal to
+   len, so that releasing the buffer zeroes what was written. */
+struct record_out
+{
+  struct lkr_buffer *buf;
+  size_t len;
+};
+
+static void
+release_record_out(void *p)
+{
+  struct record_out *out = p;
+
+  lkr_arena_release(out->buf);
+}
+
+/* Start an empty output buffer with room for len bytes, released
+   when the current dynwind context is left. */
+static void
+scm_dynwind_record_out(struct record_out *out, size_t len)
+{
+  out->len = 0;
+  out->buf = lkr_arena_acquire(len);
+
+  if(out->buf == NULL)
+    {
+      scm_report_out_of_memory();
+    }
+
+  out->buf->used = 0;
+
+  scm_dynwind_unwind_handler(release_record_out, out, SCM_F_WIND_EXPLICITLY);
+}
+
+/* Make room for n more bytes and return where they go.
+   lkr_arena_grow does not keep the contents, so a larger buffer is
+   acquired and the old one released. */
+static unsigned char *
+record_reserve(struct record_out *out, size_t n)
+{
+  struct lkr_buffer *larger;
+
+  if(out->len + n > out->buf->size)
+    {
+      larger = lkr_arena_acquire(2 * (out->len + n));
+
+      if(larger == NULL)
+	{
+	  scm_report_out_of_memory();
+	}
+
+      memcpy(larger->data, out->buf->data, out->len);
+      larger->used = out->len;
+
+      lkr_arena_release(out->buf);
+      out->buf = larger;
+    }
+
+  return (unsigned char *)out->buf->data + out->len;
+}
+
+static void
+record_commit(struct record_out *out, size_t n)
+{
+  out->len += n;
+  out->buf->used = out->len;
+}
+
+static void
+record_put_varint(struct record_out *out, uint64_t x)
+{
+  unsigned char *p = record_reserve(out, 10);
+  size_t n = 0;
+
+  while(x >= 0x80)
+    {
+      p[n++] = (unsigned char)(x | 0x80);
+      x >>= 7;
+    }
+
+  p[n++] = (unsigned char)x;
+
+  record_commit(out, n);
+}
+
+static void
+record_put_bytes(struct record_out *out, const void *data, size_t len)
+{
+  record_put_varint(out, len);
+  memcpy(record_reserve(out, len), data, len);
+  record_commit(out, len);
+}
+
+static size_t
+utf8_width(scm_t_wchar c)
+{
+  return c < 0x80 ? 1 : c < 0x800 ? 2 : c < 0x10000 ? 3 : 4;
+}
+
+/* Writes the UTF-8 form of c at p, and returns its width. */
+static size_t
+utf8_put(unsigned char *p, scm_t_wchar c)
+{
+  size_t n = utf8_width(c);
+
+  switch(n)
+    {
+    case 1:
+      p[0] = (unsigned char)c;
+      break;
+    case 2:
+      p[0] = (unsigned char)(0xc0 | c >> 6);
+      p[1] = (unsigned char)(0x80 | (c & 0x3f));
+      break;
+    case 3:
+      p[0] = (unsigned char)(0xe0 | c >> 12);
+      p[1] = (unsigned char)(0x80 | (c >> 6 & 0x3f));
+      p[2] = (unsigned char)(0x80 | (c & 0x3f));
+      break;
+    default:
+      p[0] = (unsigned char)(0xf0 | c >> 18);
+      p[1] = (unsigned char)(0x80 | (c >> 12 & 0x3f));
+      p[2] = (unsigned char)(0x80 | (c >> 6 & 0x3f));
+      p[3] = (unsigned char)(0x80 | (c & 0x3f));
+      break;
+    }
+
+  return n;
+}
+
+static size_t
+utf8_length(SCM str)
+{
+  size_t chars = scm_c_string_length(str);
+  size_t len = 0;
+  size_t i;
+
+  for(i = 0; i < chars; i++)
+    {
+      len += utf8_width(SCM_CHAR(scm_c_string_ref(str, i)));
+    }
+
+  return len;
+}
+
+/* Writes the UTF-8 form of str, utf8_length(str) bytes, at p. */
+static void
+utf8_encode(unsigned char *p, SCM str)
+{
+  size_t chars = scm_c_string_length(str);
+  size_t i;
+
+  for(i = 0; i < chars; i++)
+    {
+      p += utf8_put(p, SCM_CHAR(scm_c_string_ref(str, i)));
+    }
+}
+
+/* The UTF-8 form of str, written straight into the buffer. */
+static void
+record_put_string(struct record_out *out, SCM str)
+{
+  size_t len = utf8_length(str);
+
+  record_put_varint(out, len);
+  utf8_encode(record_reserve(out, len), str);
+  record_commit(out, len);
+}
+
+/* FNV-1a. */
+static unsigned long
+hash_name(const void *data, size_t len)
+{
+  const unsigned char *p = data;
+  uint32_t h = 2166136261u;
+  size_t i;
+
+  for(i = 0; i < len; i++)
+    {
+      h = (h ^ p[i]) * 16777619u;
+    }
+
+  return h % NAME_CACHE_SIZE;
+}
+
+static void
+cache_name(SCM entry)
+{
+  SCM bytes = SCM_CDR(entry);
+
+  scm_c_vector_set_x(names_by_symbol, scm_ihashq(SCM_CAR(entry), NAME_CACHE_SIZE), entry);
+  scm_c_vector_set_x(names_by_bytes,
+		     hash_name(SCM_BYTEVECTOR_CONTENTS(bytes), SCM_BYTEVECTOR_LENGTH(bytes)),
+		     entry);
+}
+
+/* The UTF-8 form of the symbol name, as a bytevector. */
+static SCM
+name_bytes(SCM name)
+{
+  SCM entry = scm_c_vector_ref(names_by_symbol, scm_ihashq(name, NAME_CACHE_SIZE));
+  SCM str;
+  SCM bytes;
+
+  if(scm_is_pair(entry) && scm_is_eq(SCM_CAR(entry), name))
+    {
+      return SCM_CDR(entry);
+    }
+
+  str = scm_symbol_to_string(name);
+  bytes = scm_c_make_bytevector(utf8_length(str));
+  utf8_encode((unsigned char *)SCM_BYTEVECTOR_CONTENTS(bytes), str);
+
+  cache_name(scm_cons(name, bytes));
+
+  return bytes;
+}
+
+/* The symbol whose name has the len UTF-8 bytes at p. */
+static SCM
+name_symbol(const char *p, size_t len)
+{
+  SCM entry = scm_c_vector_ref(names_by_bytes, hash_name(p, len));
+  SCM name;
+  SCM bytes;
+
+  if(scm_is_pair(entry)
+     && SCM_BYTEVECTOR_LENGTH(SCM_CDR(entry)) == len
+     && memcmp(SCM_BYTEVECTOR_CONTENTS(SCM_CDR(entry)), p, len) == 0)
+    {
+      return SCM_CAR(entry);
+    }
+
+  name = scm_from_utf8_symboln(p, len);
+  bytes = scm_c_make_bytevector(len);
+  memcpy(SCM_BYTEVECTOR_CONTENTS(bytes), p, len);
+
+  cache_name(scm_cons(name, bytes));
+
+  return name;
+}
+
+static void
+record_put_name(struct record_out *out, SCM name)
+{
+  SCM bytes = name_bytes(name);
+
+  record_put_bytes(out, SCM_BYTEVECTOR_CONTENTS(bytes), SCM_BYTEVECTOR_LENGTH(bytes));
+  scm_remember_upto_here_1(bytes);
+}
+
+static void
+record_put_tag(struct record_out *out, enum key_record_tag tag)
+{
+  *record_reserve(out, 1) = (unsigned char)tag;
+  record_commit(out, 1);
+}
+
+/* Encode the alist fields into out, after the version byte. */
+static void
+encode_record(struct record_out *out, SCM fields, const char *subr)
+{
+  SCM rest;
+
+  *record_reserve(out, 1) = KEY_RECORD_VERSION;
+  record_commit(out, 1);
+
+  for(rest = fields; scm_is_pair(rest); rest = SCM_CDR(rest))
+    {
+      SCM field = SCM_CAR(rest);
+      SCM name;
+      SCM value;
+
+      SCM_ASSERT_TYPE(scm_is_pair(field) && scm_is_symbol(SCM_CAR(field)),
+		      fields, SCM_ARG1, subr, KEY_RECORD_DESC);
+
+      name = SCM_CAR(field);
+      value = SCM_CDR(field);
+
+      if(scm_is_signed_integer(value, INT64_MIN, INT64_MAX))
+	{
+	  int64_t x = scm_to_int64(value);
+
+	  record_put_tag(out, KEY_RECORD_INT);
+	  record_put_name(out, name);
+	  record_put_varint(out, ((uint64_t)x << 1) ^ (uint64_t)(x >> 63));
+	}
+      else if(scm_is_bytevector(value))
+	{
+	  record_put_tag(out, KEY_RECORD_BYTES);
+	  record_put_name(out, name);
+	  record_put_bytes(out, SCM_BYTEVECTOR_CONTENTS(value),
+			   SCM_BYTEVECTOR_LENGTH(value));
+	}
+      else if(scm_is_string(value))
+	{
+	  record_put_tag(out, KEY_RECORD_STRING);
+	  record_put_name(out, name);
+	  record_put_string(out, value);
+	}
+      else if(scm_is_bool(value))
+	{
+	  record_put_tag(out, scm_is_true(value) ? KEY_RECORD_TRUE : KEY_RECORD_FALSE);
+	  record_put_name(out, name);
+	}
+      else
+	{
+	  SCM_ASSERT_TYPE(0, fields, SCM_ARG1, subr, KEY_RECORD_DESC);
+	}
+    }
+
+  SCM_ASSERT_TYPE(scm_is_null(rest), fields, SCM_ARG1, subr, KEY_RECORD_DESC);
+}
+
+
+/* ******************************************************************
+   Decoding
+*/
+
+struct record_in
+{
+  const unsigned char *data;
+  size_t len;
+  size_t pos;
+  const char *subr;
+};
+
+static void record_malformed(struct record_in *in) SCM_NORETURN;
+
+static void
+record_malformed(struct record_in *in)
+{
+  scm_misc_error(in->subr, "Malformed key record at byte ~A",
+		 scm_list_1(scm_from_size_t(in->pos)));
+}
+
+static uint64_t
+record_get_varint(struct record_in *in)
+{
+  uint64_t x = 0;
+  int shift;
+
+  for(shift = 0; shift < 64; shift += 7)
+    {
+      unsigned char b;
+
+      if(in->pos == in->len)
+	{
+	  record_malformed(in);
+	}
+
+      b = in->data[in->pos++];
+      x |= (uint64_t)(b & 0x7f) << shift;
+
+      if(!(b & 0x80))
+	{
+	  return x;
+	}
+    }
+
+  record_malformed(in);
+  return 0;
+}
+
+/* The next length-prefixed field, left in place. */
+static const char *
+record_get_bytes(struct record_in *in, size_t *len)
+{
+  uint64_t n = record_get_varint(in);
+  const char *p = (const char *)in->data + in->pos;
+
+  if(n > in->len - in->pos)
+    {
+      record_malformed(in);
+    }
+
+  in->pos += n;
+  *len = n;
+
+  return p;
+}
+
+static SCM
+decode_record(const void *data, size_t len, const char *subr)
+{
+  struct record_in in = { data, len, 0, subr };
+  SCM fields = SCM_EOL;
+
+  if(len == 0)
+    {
+      record_malformed(&in);
+    }
+
+  if(in.data[0] != KEY_RECORD_VERSION)
+    {
+      scm_misc_error(subr, "Unsupported key record version ~A",
+		     scm_list_1(scm_from_uint8(in.data[0])));
+    }
+
+  in.pos = 1;
+
+  while(in.pos < in.len)
+    {
+      unsigned char tag = in.data[in.pos++];
+      const char *p;
+      size_t n;
+      SCM name;
+      SCM value;
+
+      p = record_get_bytes(&in, &n);
+      name = name_symbol(p, n);
+
+      switch(tag)
+	{
+	case KEY_RECORD_INT:
+	  {
+	    uint64_t x = record_get_varint(&in);
+
+	    value = scm_from_int64((int64_t)(x >> 1) ^ -(int64_t)(x & 1));
+	  }
+	  break;
+
+	case KEY_RECORD_BYTES:
+	  p = record_get_bytes(&in, &n);
+	  value = scm_c_make_bytevector(n);
+	  memcpy(SCM_BYTEVECTOR_CONTENTS(value), p, n);
+	  break;
+
+	case KEY_RECORD_STRING:
+	  p = record_get_bytes(&in, &n);
+	  value = scm_from_utf8_stringn(p, n);
+	  break;
+
+	case KEY_RECORD_FALSE:
+	  value = SCM_BOOL_F;
+	  break;
+
+	case KEY_RECORD_TRUE:
+	  value = SCM_BOOL_T;
+	  break;
+
+	default:
+	  in.pos--;
+	  record_malformed(&in);
+	  return SCM_BOOL_F;
+	}
+
+      fields = scm_cons(scm_cons(name, value), fields);
+    }
+
+  return scm_reverse_x(fields, SCM_EOL);
+}
+
+
+/* ******************************************************************
+   Armour
+*/
+
+static int
+armour_value(scm_t_wchar c)
+{
+  if(c >= 'A' && c <= 'Z')
+    {
+      return c - 'A';
+    }
+  if(c >= 'a' && c <= 'z')
+    {
+      return c - 'a' + 26;
+    }
+  if(c >= '0' && c <= '9')
+    {
+      return c - '0' + 52;
+    }
+  if(c == '-')
+    {
+      return 62;
+    }
+  if(c == '_')
+    {
+      return 63;
+    }
+
+  return -1;
+}
+
+/* Armour len bytes at data into out. */
+static void
+armour(struct record_out *out, const unsigned char *data, size_t len)
+{
+  unsigned char *p = record_reserve(out, (len + 2) / 3 * 4);
+  size_t n = 0;
+  size_t i;
+
+  for(i = 0; i + 2 < len; i += 3)
+    {
+      uint32_t x = (uint32_t)data[i] << 16 | (uint32_t)data[i + 1] << 8 | data[i + 2];
+
+      p[n++] = armour_chars[x >> 18];
+      p[n++] = armour_chars[(x >> 12) & 0x3f];
+      p[n++] = armour_chars[(x >> 6) & 0x3f];
+      p[n++] = armour_chars[x & 0x3f];
+    }
+
+  if(i < len)
+    {
+      uint32_t x = (uint32_t)data[i] << 16;
+
+      if(i + 1 < len)
+	{
+	  x |= (uint32_t)data[i + 1] << 8;
+	}
+
+      p[n++] = armour_chars[x >> 18];
+      p[n++] = armour_chars[(x >> 12) & 0x3f];
+
+      if(i + 1 < len)
+	{
+	  p[n++] = armour_chars[(x >> 6) & 0x3f];
+	}
+    }
+
+  record_commit(out, n);
+}
+
+/* Strip the armour from the string text into out. Returns -1, or the
+   index of the first character that is not armour, or the length if
+   it is not a possible armoured length. */
+static long
+unarmour(struct record_out *out, SCM text)
+{
+  size_t len = scm_c_string_length(text);
+  unsigned char *p = record_reserve(out, len / 4 * 3 + 2);
+  uint32_t x = 0;
+  size_t n = 0;
+  size_t i;
+
+  if(len % 4 == 1)
+    {
+      return (long)len;
+    }
+
+  for(i = 0; i < len; i++)
+    {
+      int v = armour_value(SCM_CHAR(scm_c_string_ref(text, i)));
+
+      if(v < 0)
+	{
+	  return (long)i;
+	}
+
+      x = x << 6 | (uint32_t)v;
+
+      if(i % 4 == 3)
+	{
+	  p[n++] = (unsigned char)(x >> 16);
+	  p[n++] = (unsigned char)(x >> 8);
+	  p[n++] = (unsigned char)x;
+	  x = 0;
+	}
+    }
+
+  switch(len % 4)
+    {
+    case 2:
+      p[n++] = (unsigned char)(x >> 4);
+      break;
+    case 3:
+      p[n++] = (unsigned char)(x >> 10);
+      p[n++] = (unsigned char)(x >> 2);
+      break;
+    }
+
+  record_commit(out, n);
+
+  return -1;
+}
+
+
+/* ******************************************************************
+   Methods
+*/
+
+SCM_DEFINE (key_record_to_bytevector,   /* Function name in C */
+            "key-record->bytevector", /* Function name in Scheme */
+            1, 0,      /* No. of required/optional args */
+            0,         /* Whether accepts "rest" arg */
+            (SCM fields), /* C argument list */
+            "Encode an alist of fields as a key record.") /* Docstring */
+{
+  struct record_out out;
+  SCM result;
+
+  scm_dynwind_begin(0);
+
+  scm_dynwind_record_out(&out, 256);
+  encode_record(&out, fields, s_key_record_to_bytevector);
+
+  result = scm_c_make_bytevector(out.len);
+  memcpy(SCM_BYTEVECTOR_CONTENTS(result), out.buf->data, out.len);
+
+  scm_dynwind_end();
+
+  return result;
+}
+
+
+SCM_DEFINE (bytevector_to_key_record,   /* Function name in C */
+            "bytevector->key-record", /* Function name in Scheme */
+            1, 0,      /* No. of required/optional args */
+            0,         /* Whether accepts "rest" arg */
+            (SCM bv), /* C argument list */
+            "Decode a key record into an alist of fields.") /* Docstring */
+{
+  SCM_ASSERT_TYPE(scm_is_bytevector(bv), bv, SCM_ARG1, s_bytevector_to_key_record, "BYTEVECTOR");
+
+  return decode_record(SCM_BYTEVECTOR_CONTENTS(bv), SCM_BYTEVECTOR_LENGTH(bv),
+		       s_bytevector_to_key_record);
+}
+
+
+SCM_DEFINE (key_record_to_callout_info,   /* Function name in C */
+            "key-record->callout-info", /* Function name in Scheme */
+            1, 0,      /* No. of required/optional args */
+            0,         /* Whether accepts "rest" arg */
+            (SCM fields), /* C argument list */
+            "Encode an alist of fields as request-key callout information.") /* Docstring */
+{
+  struct record_out record;
+  struct record_out text;
+  SCM result;
+
+  scm_dynwind_begin(0);
+
+  scm_dynwind_record_out(&record, 256);
+  encode_record(&record, fields, s_key_record_to_callout_info);
+
+  scm_dynwind_record_out(&text, (record.len + 2) / 3 * 4);
+  armour(&text, (const unsigned char *)record.buf->data, record.len);
+
+  result = scm_from_latin1_stringn(text.buf->data, text.len);
+
+  scm_dynwind_end();
+
+  return result;
+}
+
+
+SCM_DEFINE (callout_info_to_key_record,   /* Function name in C */
+            "callout-info->key-record", /* Function name in Scheme */
+            1, 0,      /* No. of required/optional args */
+            0,         /* Whether accepts "rest" arg */
+            (SCM info), /* C argument list */
+            "Decode request-key callout information into an alist of fields.") /* Docstring */
+{
+  struct record_out record;
+  long bad = 0;
+  SCM result;
+
+  SCM_ASSERT_TYPE(scm_is_string(info), info, SCM_ARG1, s_callout_info_to_key_record, "STRING");
+
+  scm_dynwind_begin(0);
+
+  scm_dynwind_record_out(&record, scm_c_string_length(info) / 4 * 3 + 2);
+
+  if((bad = unarmour(&record, info)) >= 0)
+    {
+      scm_misc_error(s_callout_info_to_key_record,
+		     "Malformed callout information at character ~A",
+		     scm_list_1(scm_from_long(bad)));
+    }
+
+  result = decode_record(record.buf->data, record.len, s_callout_info_to_key_record);
+
+  scm_dynwind_end();
+
+  return result;
+}
+
+
+/* ******************************************************************
+   Initialization
+*/
+
+void
+init_lkr_codec(void)
+{
+  names_by_symbol = scm_gc_protect_object(scm_c_make_vector(NAME_CACHE_SIZE, SCM_BOOL_F));
+  names_by_bytes = scm_gc_protect_object(scm_c_make_vector(NAME_CACHE_SIZE, SCM_BOOL_F));
+
+  scm_c_define("KEY_RECORD_VERSION", scm_from_int(KEY_RECORD_VERSION));
+
+  #include "codec.x"
+}
@@ -0,0 +1,148 @@
+/* Copyright (C) 2016 Kirk Zurell.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/* guile-linux-key-retention: argument conversions shared by the
+   wrappers.
+
+   Serials and other small numbers are fixnums nearly always. libguile
+   checks for fixnums before its general path too, but out of line, so
+   those are taken inline here first, and everything else goes to the
+   public conversions, which also raise the errors. */
+
+#ifndef GUILE_LKR_CONVERT_H
+#define GUILE_LKR_CONVERT_H
+
+#include <limits.h>
+#include <stdint.h>
+
+#include <libguile.h>
+
+#include <keyutils.h>
+
+#include "arena.h"
+#include "keyhandle.h"
+
+#define KEY_SERIAL_DESC "NUM or KEY-HANDLE"
+#define STRING_DESC "STRING"
+#define BOOL_DESC "BOOL"
+#define NUM_DESC "NUM"
+#define PAYLOAD_DESC "STRING or BYTEVECTOR"
+#define OR_FALSE " or #f"
+
+/* This is probably not the correct way to do this. */
+#define scm_is_undefined(x) (scm_is_eq(x, SCM_UNDEFINED))
+
+/* Whether x is a fixnum in [lo, hi]. The fixnum macros are the same
+   in Guile 2.0, 2.2 and 3.0. */
+#define lkr_is_fixnum_in(x, lo, hi) \
+  (SCM_I_INUMP(x) && SCM_I_INUM(x) >= (lo) && SCM_I_INUM(x) <= (hi))
+
+static inline SCM
+scm_from_key_serial_t(key_serial_t x)
+{
+  if(SCM_FIXABLE((scm_t_signed_bits)x))
+    {
+      return SCM_I_MAKINUM(x);
+    }
+
+  return scm_from_int32(x);
+}
+
+/* Key handles (see keyhandle.c) stand for their serials. */
+static inline key_serial_t
+scm_to_key_serial_t(SCM x)
+{
+  if(lkr_is_fixnum_in(x, INT32_MIN, INT32_MAX))
+    {
+      return (key_serial_t)SCM_I_INUM(x);
+    }
+
+  return lkr_is_key_handle(x) ? lkr_key_handle_serial(x) : scm_to_int32(x);
+}
+
+static inline int
+scm_is_key_serial_t(SCM x)
+{
+  return SCM_I_INUMP(x) || scm_is_number(x) || lkr_is_key_handle(x);
+}
+
+static inline int
+scm_is_payload(SCM x)
+{
+  return scm_is_bytevector(x) || scm_is_string(x);
+}
+
+/* Timeouts and error numbers. */
+static inline unsigned
+scm_to_lkr_unsigned(SCM x)
+{
+  if(lkr_is_fixnum_in(x, 0, INT_MAX))
+    {
+      return (unsigned)SCM_I_INUM(x);
+    }
+
+  return scm_to_unsigned_integer(x, 0, INT_MAX);
+}
+
+static inline int
+scm_to_lkr_int(SCM x)
+{
+  if(lkr_is_fixnum_in(x, INT_MIN, INT_MAX))
+    {
+      return (int)SCM_I_INUM(x);
+    }
+
+  return scm_to_int(x);
+}
+
+static inline key_perm_t
+scm_to_lkr_perm(SCM x)
+{
+  return (key_perm_t)scm_to_uint32(x);
+}
+
+/* A uid or gid, where #f or an omitted argument means -1, "unchanged"
+   or "the caller's". */
+static inline int
+scm_to_lkr_id(SCM x)
+{
+  if(scm_is_false(x) || scm_is_undefined(x))
+    {
+      return -1;
+    }
+
+  if(lkr_is_fixnum_in(x, -1, INT_MAX))
+    {
+      return (int)SCM_I_INUM(x);
+    }
+
+  return scm_to_signed_integer(x, -1, INT_MAX);
+}
+
+/* Staging strings in a buffer from arena.c, defined in main.c. */
+
+/* Makes room for n more bytes at pos in buf, keeping what is there. */
+void lkr_stage_reserve(struct lkr_buffer *buf, size_t pos, size_t n);
+
+/* Appends str to buf at *pos in the locale's encoding, NUL-terminated
+   if terminate is non-zero, and returns the offset it starts at.
+   Raises an error on behalf of subr if str cannot be encoded. */
+size_t lkr_stage_string(struct lkr_buffer *buf, size_t *pos, SCM str,
+			int terminate, const char *subr);
+
+#endif /* GUILE_LKR_CONVERT_H */
@@ -0,0 +1,142 @@
+ ;; Copyright (C) 2016 Kirk Zurell.
+
+ ;; guile-linux-key-retention is free software; you can redistribute
+ ;; it and/or modify it under the terms of the GNU Lesser General
+ ;; Public License as published by the Free Software Foundation;
+ ;; either version 3 of the License, or (at your option) any later
+ ;; version.
+
+ ;; This library is distributed in the hope that it will be useful, but
+ ;; WITHOUT ANY WARRANTY; without even the implied warranty of
+ ;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ ;; Lesser General Public License for more details.
+
+ ;; You should have received a copy of the GNU Lesser General Public
+ ;; License along with this library; if not, write to the Free Software
+ ;; Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ ;; 02110-1301 USA
+
+;;; Key calls that suspend the calling fiber rather than its thread.
+;;;
+;;; Each call is made by a key job on one of the extension's worker
+;;; threads, and the calling fiber waits on the job's condition only.
+;;; One reaper fiber per scheduler waits on the completion descriptor,
+;;; reaps the finished jobs and signals their conditions, so a
+;;; completion wakes the reapers and the job's own waiter, not every
+;;; waiting fiber.
+;;;
+;;; Special keyring ids are resolved when the job is submitted, against
+;;; the keyrings of the thread the fiber is running on at the time, not
+;;; the worker's. A fiber that may migrate between threads should not
+;;; rely on KEY_SPEC_THREAD_KEYRING.
+
+(define-module (linux-key-retention fibers)
+  #:use-module (ice-9 threads)
+  #:use-module (fibers)
+  #:use-module (fibers conditions)
+  #:use-module (fibers io-wakeup)
+  #:use-module (fibers operations)
+  #:use-module (linux-key-retention guile-linux-key-retention)
+  #:export (request-key/fibers
+            keyctl-search/fibers
+            keyctl-read/fibers))
+
+;; Only ever waited on, never read from, so its buffer stays empty.
+(define completion-port
+  (let ((port (fdopen (key-job-completion-fd) "r")))
+    ;; The descriptor is the extension's; the port must not close it.
+    (set-port-revealed! port 1)
+    port))
+
+;; Job id -> (job . condition), for the fibers waiting on unreaped
+;; jobs.
+(define waiters (make-hash-table))
+(define waiter-count 0)
+
+;; Schedulers with a reaper running. Weak, as a reaper is abandoned
+;; with its scheduler, and the next scheduler needs one of its own.
+(define reaped-schedulers (make-weak-key-hash-table))
+
+;; Guards waiters, waiter-count and reaped-schedulers.
+(define waiters-lock (make-mutex))
+
+;; current-scheduler moved from (fibers internal) to (fibers scheduler)
+;; in later Fibers releases.
+(define current-scheduler
+  (module-ref (or (resolve-module '(fibers scheduler) #:ensure #f)
+                  (resolve-module '(fibers internal)))
+              'current-scheduler))
+
+;; Call with waiters-lock held.
+(define (remove-waiter! id)
+  (let ((entry (hashv-ref waiters id)))
+    (when entry
+      (hashv-remove! waiters id)
+      (set! waiter-count (1- waiter-count)))
+    entry))
+
+(define (signal-waiter! id)
+  (let ((entry (with-mutex waiters-lock (remove-waiter! id))))
+    (when entry
+      (signal-condition! (cdr entry)))))
+
+(define (reap!)
+  (for-each signal-waiter! (key-job-reap))
+  ;; The ids the pipe had no room for are lost, so look at every job.
+  (when (key-job-overflow?)
+    (for-each signal-waiter!
+              (with-mutex waiters-lock
+                (hash-fold (lambda (id entry ids)
+                             (if (key-job-done? (car entry)) (cons id ids) ids))
+                           '() waiters)))))
+
+;; Runs until no fiber waits, so that it never holds up a scheduler
+;; that is draining its fibers. Every waiter's job writes to the pipe
+;; when it finishes, so the reaper wakes after the last one leaves.
+(define (reaper sched)
+  (lambda ()
+    (let loop ()
+      (perform-operation (wait-until-port-readable-operation completion-port))
+      (reap!)
+      (when (with-mutex waiters-lock
+              (or (positive? waiter-count)
+                  (begin
+                    (hashq-remove! reaped-schedulers sched)
+                    #f)))
+        (loop)))))
+
+(define (wait-for-job job)
+  (let ((done (make-condition))
+        (id (key-job-id job))
+        (sched (current-scheduler)))
+    (when (with-mutex waiters-lock
+            (hashv-set! waiters id (cons job done))
+            (set! waiter-count (1+ waiter-count))
+            (and (not (hashq-ref reaped-schedulers sched))
+                 (begin
+                   (hashq-set! reaped-schedulers sched #t)
+                   #t)))
+      (spawn-fiber (reaper sched) sched))
+    ;; Checking only after registering means a job reaped in the
+    ;; meantime is either seen done here, or signalled.
+    (if (key-job-done? job)
+        (with-mutex waiters-lock
+          (remove-waiter! id))
+        (perform-operation (wait-operation done)))
+    (key-job-result job)))
+
+(define* (request-key/fibers keytype description
+                             #:optional (callout-info #f) (dest-keyring #f))
+  "Like request-key, but suspends only the calling fiber."
+  (wait-for-job
+   (key-job-submit-request-key keytype description callout-info dest-keyring)))
+
+(define* (keyctl-search/fibers keyring keytype description
+                               #:optional (dest-keyring #f))
+  "Like keyctl-search, but suspends only the calling fiber."
+  (wait-for-job
+   (key-job-submit-search keyring keytype description dest-keyring)))
+
+(define (keyctl-read/fibers key)
+  "Like keyctl-read, but suspends only the calling fiber."
+  (wait-for-job (key-job-submit-read key)))
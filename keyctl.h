@@ -0,0 +1,140 @@
+/* Copyright (C) 2016 Kirk Zurell.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/* guile-linux-key-retention: the keyctl operations that take
+   numbers, strings and payloads, one line each.
+
+   main.c makes each line a wrapper, and stats.h a counter. Each line
+   gives
+
+     the KEYCTL_ command, without its prefix;
+     the Scheme name;
+     the C name;
+     the docstring;
+     the numbers of required and optional arguments;
+     how the result is returned: SERIAL, as a key serial; LONG, as a
+       number; TRUE_IF_ZERO, as #t if it is zero, or else a number;
+     whether the call changes a key's attributes, which marks cached
+       key handle descriptions stale (see keyhandle.c);
+     and the arguments, in the order keyctl takes them, as (kind name).
+
+   The argument kinds are
+
+     SERIAL      a key serial or key handle;
+     OPT_SERIAL  the same, or #f, or omitted, for 0;
+     OPT_BOOL    a boolean, or omitted, for #f;
+     UINT        a number in [0, INT_MAX];
+     INT         a number in the range of int;
+     PERM        a key_perm_t;
+     OPT_ID      a uid or gid, or #f, or omitted, for -1;
+     STRING      a string, passed NUL-terminated in the locale's encoding;
+     OPT_STRING  the same, or #f, or omitted, for NULL;
+     PAYLOAD     a string or bytevector, passed as a pointer and a length;
+     OPT_PAYLOAD the same, or #f, or omitted, for NULL and 0.
+
+   Strings and payloads are staged in one buffer (see arena.c), which
+   is zeroed when the call returns.
+
+   add_key and request_key are system calls of their own, and the
+   operations that read into a buffer (KEYCTL_DESCRIBE, KEYCTL_READ,
+   KEYCTL_GET_SECURITY) return what they read, so those wrappers are
+   written out in main.c.
+*/
+
+#ifndef GUILE_LKR_KEYCTL_H
+#define GUILE_LKR_KEYCTL_H
+
+/* Older keyutils.h files predate persistent keyrings. */
+#ifndef KEYCTL_GET_PERSISTENT
+#define KEYCTL_GET_PERSISTENT 22
+#endif
+
+/* Nor restricted keyrings. */
+#ifndef KEYCTL_RESTRICT_KEYRING
+#define KEYCTL_RESTRICT_KEYRING 29
+#endif
+
+#define LKR_KEYCTL_OPS(X)                                                     \
+  X(GET_KEYRING_ID, "keyctl-get-keyring-id", keyctl_get_keyring_ID_wrapper,   \
+    "Get the ID of a keyring.",                                               \
+    1, 1, SERIAL, 0, ((SERIAL, id), (OPT_BOOL, create)))                      \
+  X(REVOKE, "keyctl-revoke", keyctl_revoke_wrapper,                           \
+    "Revoke a key.",                                                          \
+    1, 0, TRUE_IF_ZERO, 1, ((SERIAL, key)))                                   \
+  X(CHOWN, "keyctl-chown", keyctl_chown_wrapper,                              \
+    "Set a key's uid and gid.",                                               \
+    1, 2, LONG, 1, ((SERIAL, key), (OPT_ID, uid), (OPT_ID, gid)))             \
+  X(SETPERM, "keyctl-setperm", keyctl_setperm_wrapper,                        \
+    "Set a key's permissions.",                                               \
+    2, 0, LONG, 1, ((SERIAL, key), (PERM, perm)))                             \
+  X(CLEAR, "keyctl-clear", keyctl_clear_wrapper,                              \
+    "Clear a keyring.",                                                       \
+    1, 0, TRUE_IF_ZERO, 0, ((SERIAL, keyring)))                               \
+  X(LINK, "keyctl-link", keyctl_link_wrapper,                                 \
+    "Link a key to a keyring.",                                               \
+    2, 0, TRUE_IF_ZERO, 0, ((SERIAL, keyring), (SERIAL, key)))                \
+  X(UNLINK, "keyctl-unlink", keyctl_unlink_wrapper,                           \
+    "Unlink a key.",                                                          \
+    2, 0, TRUE_IF_ZERO, 0, ((SERIAL, keyring), (SERIAL, key)))                \
+  X(NEGATE, "keyctl-negate", keyctl_negate_wrapper,                           \
+    "Negate a key.",                                                          \
+    2, 1, LONG, 0, ((SERIAL, key), (UINT, timeout), (OPT_SERIAL, keyring)))   \
+  X(REJECT, "keyctl-reject", keyctl_reject_wrapper,                           \
+    "Rejects a key.",                                                         \
+    3, 1, LONG, 0, ((SERIAL, key), (UINT, timeout), (UINT, error), (OPT_SERIAL, keyring))) \
+  X(SET_REQKEY_KEYRING, "keyctl-set-reqkey-keyring", keyctl_set_reqkey_keyring_wrapper, \
+    "Sets a requested key's keyring.",                                        \
+    1, 0, LONG, 0, ((INT, reqkey_defl)))                                      \
+  X(SET_TIMEOUT, "keyctl-set-timeout", keyctl_set_timeout_wrapper,            \
+    "Sets a key's timeout.",                                                  \
+    2, 0, TRUE_IF_ZERO, 0, ((SERIAL, key), (UINT, timeout)))                  \
+  X(ASSUME_AUTHORITY, "keyctl-assume-authority", keyctl_assume_authority_wrapper, \
+    "Assumes authority over a key.",                                          \
+    0, 1, TRUE_IF_ZERO, 0, ((OPT_SERIAL, key)))                               \
+  X(SESSION_TO_PARENT, "keyctl-session-to-parent", keyctl_session_to_parent_wrapper, \
+    "Map session keychain to parent.",                                        \
+    0, 0, TRUE_IF_ZERO, 0, ())                                                \
+  X(INVALIDATE, "keyctl-invalidate", keyctl_invalidate_wrapper,               \
+    "Invalidate a key.",                                                      \
+    1, 0, TRUE_IF_ZERO, 1, ((SERIAL, key)))                                   \
+  X(GET_PERSISTENT, "keyctl-get-persistent", keyctl_get_persistent_wrapper,   \
+    "Get a user's persistent keyring and link it into a keyring.",            \
+    2, 0, SERIAL, 0, ((OPT_ID, uid), (SERIAL, keyring)))                      \
+  X(JOIN_SESSION_KEYRING, "keyctl-join-session-keyring",                      \
+    keyctl_join_session_keyring_wrapper,                                      \
+    "Join session keyring.",                                                  \
+    0, 1, SERIAL, 0, ((OPT_STRING, name)))                                    \
+  X(UPDATE, "keyctl-update", keyctl_update_wrapper,                           \
+    "Update a key's payload.",                                                \
+    1, 1, LONG, 0, ((SERIAL, key), (OPT_PAYLOAD, payload)))                   \
+  X(SEARCH, "keyctl-search", keyctl_search_wrapper,                           \
+    "Search for a key by description.",                                       \
+    3, 1, TRUE_IF_ZERO, 0, ((SERIAL, keyring), (STRING, keytype),             \
+                            (STRING, description),                            \
+                            (OPT_SERIAL, dest_keyring)))                      \
+  X(INSTANTIATE, "keyctl-instantiate", keyctl_instantiate_wrapper,            \
+    "Instantiate a requested key.",                                           \
+    2, 1, SERIAL, 0, ((SERIAL, key), (PAYLOAD, payload),                      \
+                      (OPT_SERIAL, keyring)))                                 \
+  X(RESTRICT_KEYRING, "keyctl-restrict-keyring",                              \
+    keyctl_restrict_keyring_wrapper,                                          \
+    "Restrict the keys that may be linked into a keyring.",                   \
+    1, 2, TRUE_IF_ZERO, 0, ((SERIAL, keyring), (OPT_STRING, keytype),         \
+                            (OPT_STRING, restriction)))
+
+#endif /* GUILE_LKR_KEYCTL_H */
@@ -0,0 +1,430 @@
+/* Copyright (C) 2016 Kirk Zurell.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/* guile-linux-key-retention: key handles.
+
+   A key handle wraps a key serial, and caches what KEYCTL_DESCRIBE
+   and KEYCTL_GET_SECURITY say about the key, so that code asking
+   about a key's type, owner or permissions makes those calls once
+   rather than every time. Every wrapper accepts a handle wherever it
+   accepts a serial.
+
+   A cached entry is tagged with the epoch it was fetched in. Changing
+   a key's attributes through the wrappers, or calling
+   key-handle-invalidate-all!, moves to a new epoch and so makes every
+   entry stale. Changes made elsewhere, for instance by another
+   process, are only seen after key-handle-refresh!, or after the
+   owner of a key-change notification calls key-handle-invalidate!.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <libguile.h>
+
+#include <keyutils.h>
+
+#include "convert.h"
+#include "keyhandle.h"
+#include "stats.h"
+
+#define KEY_HANDLE_DESC "KEY-HANDLE"
+
+static scm_t_bits key_handle_tag;
+
+/* The cached entries are written whole, as a single SCM, so that
+   threads sharing a handle never see half an entry.
+
+   description is #(epoch type uid gid perm description) or #f.
+   security is (epoch . label) or #f.
+*/
+struct lkr_key_handle
+{
+  key_serial_t serial;
+  SCM description;
+  SCM security;
+};
+
+enum
+  {
+    DESC_EPOCH,
+    DESC_TYPE,
+    DESC_UID,
+    DESC_GID,
+    DESC_PERM,
+    DESC_DESCRIPTION,
+    DESC_SIZE
+  };
+
+static unsigned long key_handle_epoch;
+
+#define KEY_HANDLE(x) ((struct lkr_key_handle *)SCM_SMOB_DATA(x))
+
+int
+lkr_is_key_handle(SCM x)
+{
+  return SCM_SMOB_PREDICATE(key_handle_tag, x);
+}
+
+key_serial_t
+lkr_key_handle_serial(SCM x)
+{
+  return KEY_HANDLE(x)->serial;
+}
+
+void
+lkr_key_handles_changed(void)
+{
+  __atomic_add_fetch(&key_handle_epoch, 1, __ATOMIC_RELEASE);
+}
+
+static unsigned long
+current_epoch(void)
+{
+  return __atomic_load_n(&key_handle_epoch, __ATOMIC_ACQUIRE);
+}
+
+static int
+is_current(SCM epoch)
+{
+  return scm_to_ulong(epoch) == current_epoch();
+}
+
+
+
+/* ******************************************************************
+   Fetching.
+*/
+
+/* Calls keyctl(cmd, serial, buffer, buflen), which returns a
+   NUL-terminated string, and returns the string. The call is counted
+   as op. Raises a system error on behalf of subr if it fails. */
+static SCM
+fetch_string(int cmd, enum lkr_stat_op op, key_serial_t serial, const char *subr)
+{
+  char stack_buffer[256];
+  char *buffer = stack_buffer;
+  size_t size = sizeof(stack_buffer);
+  long result = 0;
+  SCM str;
+
+  scm_dynwind_begin(0);
+
+  /* The result is the length the string needs, so a second call with
+     a larger buffer is enough unless the string grows in between. */
+  while((result = keyctl(cmd, serial, buffer, size)) > (long)size)
+    {
+      size = result;
+      buffer = scm_malloc(size);
+      scm_dynwind_free(buffer);
+    }
+
+  lkr_stat(op, result);
+
+  if(result < 0)
+    {
+      scm_syserror(subr);
+    }
+
+  // Remove final zero.
+  str = scm_from_locale_stringn(buffer, result > 0 ? result - 1 : 0);
+
+  scm_dynwind_end();
+
+  return str;
+}
+
+/* Parses "type;uid;gid;perm;description" into a cache entry. */
+static SCM
+parse_description(SCM desc, SCM epoch, const char *subr)
+{
+  char *text = NULL;
+  char *fields[DESC_SIZE - 1];
+  char *p = NULL;
+  SCM entry;
+  int i;
+
+  scm_dynwind_begin(0);
+
+  text = scm_to_locale_string(desc);
+  scm_dynwind_free(text);
+
+  /* The description itself may contain semicolons. */
+  for(i = 0, p = text; i < DESC_SIZE - 2; i++)
+    {
+      fields[i] = p;
+
+      if((p = strchr(p, ';')) == NULL)
+	{
+	  scm_misc_error(subr, "Unexpected key description: ~S",
+			 scm_list_1(desc));
+	}
+
+      *p++ = '\0';
+    }
+  fields[i] = p;
+
+  entry = scm_c_make_vector(DESC_SIZE, SCM_BOOL_F);
+  scm_c_vector_set_x(entry, DESC_EPOCH, epoch);
+  scm_c_vector_set_x(entry, DESC_TYPE, scm_from_locale_string(fields[0]));
+  scm_c_vector_set_x(entry, DESC_UID, scm_from_long(strtol(fields[1], NULL, 10)));
+  scm_c_vector_set_x(entry, DESC_GID, scm_from_long(strtol(fields[2], NULL, 10)));
+  scm_c_vector_set_x(entry, DESC_PERM, scm_from_ulong(strtoul(fields[3], NULL, 16)));
+  scm_c_vector_set_x(entry, DESC_DESCRIPTION, scm_from_locale_string(fields[4]));
+
+  scm_dynwind_end();
+
+  return entry;
+}
+
+/* The handle's description entry, fetched if missing or stale. */
+static SCM
+description_entry(SCM handle, const char *subr)
+{
+  struct lkr_key_handle *kh = KEY_HANDLE(handle);
+  SCM entry = kh->description;
+  int hit = scm_is_true(entry) && is_current(SCM_SIMPLE_VECTOR_REF(entry, DESC_EPOCH));
+
+  lkr_stat_cache(hit);
+
+  if(!hit)
+    {
+      /* Take the epoch before the call, so that a change made during
+	 it leaves the entry stale. */
+      SCM epoch = scm_from_ulong(current_epoch());
+
+      entry = parse_description(fetch_string(KEYCTL_DESCRIBE, LKR_STAT_DESCRIBE,
+					     kh->serial, subr),
+				epoch, subr);
+      kh->description = entry;
+    }
+
+  return entry;
+}
+
+static SCM
+security_entry(SCM handle, const char *subr)
+{
+  struct lkr_key_handle *kh = KEY_HANDLE(handle);
+  SCM entry = kh->security;
+  int hit = scm_is_true(entry) && is_current(scm_car(entry));
+
+  lkr_stat_cache(hit);
+
+  if(!hit)
+    {
+      SCM epoch = scm_from_ulong(current_epoch());
+
+      entry = scm_cons(epoch, fetch_string(KEYCTL_GET_SECURITY, LKR_STAT_GET_SECURITY,
+					   kh->serial, subr));
+      kh->security = entry;
+    }
+
+  return entry;
+}
+
+
+
+/* ******************************************************************
+   SMOB
+*/
+
+static int
+print_key_handle(SCM handle, SCM port, scm_print_state *pstate)
+{
+  struct lkr_key_handle *kh = KEY_HANDLE(handle);
+
+  scm_puts("#<key-handle ", port);
+  scm_intprint(kh->serial, 10, port);
+
+  /* Only what is already known; printing makes no calls. */
+  if(scm_is_true(kh->description))
+    {
+      scm_puts(" ", port);
+      scm_display(SCM_SIMPLE_VECTOR_REF(kh->description, DESC_TYPE), port);
+      scm_puts(" ", port);
+      scm_write(SCM_SIMPLE_VECTOR_REF(kh->description, DESC_DESCRIPTION), port);
+    }
+
+  scm_puts(">", port);
+
+  return 1;
+}
+
+static SCM
+equalp_key_handle(SCM a, SCM b)
+{
+  return scm_from_bool(KEY_HANDLE(a)->serial == KEY_HANDLE(b)->serial);
+}
+
+
+
+/* ******************************************************************
+   Methods
+*/
+
+SCM_DEFINE (make_key_handle,   /* Function name in C */
+            "make-key-handle", /* Function name in Scheme */
+            1, 0,      /* No. of required/optional args */
+            0,         /* Whether accepts "rest" arg */
+            (SCM key), /* C argument list */
+            "Make a handle for the key with serial @var{key}. Nothing is fetched until asked for.") /* Docstring */
+{
+  struct lkr_key_handle *kh = NULL;
+
+  if(lkr_is_key_handle(key))
+    {
+      return key;
+    }
+
+  SCM_ASSERT_TYPE(scm_is_number(key), key, SCM_ARG1, s_make_key_handle, KEY_SERIAL_DESC);
+
+  /* Collectable memory, scanned for the cached entries. */
+  kh = scm_gc_malloc(sizeof(*kh), "key-handle");
+  kh->serial = scm_to_key_serial_t(key);
+  kh->description = SCM_BOOL_F;
+  kh->security = SCM_BOOL_F;
+
+  SCM_RETURN_NEWSMOB(key_handle_tag, kh);
+}
+
+
+SCM_DEFINE (key_handle_p,   /* Function name in C */
+            "key-handle?", /* Function name in Scheme */
+            1, 0,      /* No. of required/optional args */
+            0,         /* Whether accepts "rest" arg */
+            (SCM obj), /* C argument list */
+            "Whether @var{obj} is a key handle.") /* Docstring */
+{
+  return scm_from_bool(lkr_is_key_handle(obj));
+}
+
+
+SCM_DEFINE (key_handle_serial,   /* Function name in C */
+            "key-handle-serial", /* Function name in Scheme */
+            1, 0,      /* No. of required/optional args */
+            0,         /* Whether accepts "rest" arg */
+            (SCM handle), /* C argument list */
+            "The serial of the key @var{handle} refers to.") /* Docstring */
+{
+  SCM_ASSERT_TYPE(lkr_is_key_handle(handle), handle, SCM_ARG1, s_key_handle_serial, KEY_HANDLE_DESC);
+
+  return scm_from_key_serial_t(KEY_HANDLE(handle)->serial);
+}
+
+
+/* The description accessors differ only in the field they return. */
+#define DESCRIPTION_ACCESSOR(cname, sname, field, doc)			\
+  SCM_DEFINE (cname, sname, 1, 0, 0, (SCM handle), doc)			\
+  {									\
+    SCM_ASSERT_TYPE(lkr_is_key_handle(handle), handle, SCM_ARG1, s_##cname, KEY_HANDLE_DESC); \
+									\
+    return SCM_SIMPLE_VECTOR_REF(description_entry(handle, s_##cname), field); \
+  }
+
+DESCRIPTION_ACCESSOR(key_handle_type, "key-handle-type", DESC_TYPE,
+		     "The type of the key @var{handle} refers to.")
+DESCRIPTION_ACCESSOR(key_handle_uid, "key-handle-uid", DESC_UID,
+		     "The uid of the key @var{handle} refers to.")
+DESCRIPTION_ACCESSOR(key_handle_gid, "key-handle-gid", DESC_GID,
+		     "The gid of the key @var{handle} refers to.")
+DESCRIPTION_ACCESSOR(key_handle_perm, "key-handle-perm", DESC_PERM,
+		     "The permissions of the key @var{handle} refers to.")
+DESCRIPTION_ACCESSOR(key_handle_description, "key-handle-description", DESC_DESCRIPTION,
+		     "The description of the key @var{handle} refers to.")
+
+
+SCM_DEFINE (key_handle_security,   /* Function name in C */
+            "key-handle-security", /* Function name in Scheme */
+            1, 0,      /* No. of required/optional args */
+            0,         /* Whether accepts "rest" arg */
+            (SCM handle), /* C argument list */
+            "The security label of the key @var{handle} refers to.") /* Docstring */
+{
+  SCM_ASSERT_TYPE(lkr_is_key_handle(handle), handle, SCM_ARG1, s_key_handle_security, KEY_HANDLE_DESC);
+
+  return scm_cdr(security_entry(handle, s_key_handle_security));
+}
+
+
+SCM_DEFINE (key_handle_refresh_x,   /* Function name in C */
+            "key-handle-refresh!", /* Function name in Scheme */
+            1, 0,      /* No. of required/optional args */
+            0,         /* Whether accepts "rest" arg */
+            (SCM handle), /* C argument list */
+            "Fetch the description of the key @var{handle} refers to again, now.") /* Docstring */
+{
+  struct lkr_key_handle *kh = NULL;
+
+  SCM_ASSERT_TYPE(lkr_is_key_handle(handle), handle, SCM_ARG1, s_key_handle_refresh_x, KEY_HANDLE_DESC);
+
+  kh = KEY_HANDLE(handle);
+  kh->description = SCM_BOOL_F;
+  kh->security = SCM_BOOL_F;
+
+  description_entry(handle, s_key_handle_refresh_x);
+
+  return handle;
+}
+
+
+SCM_DEFINE (key_handle_invalidate_x,   /* Function name in C */
+            "key-handle-invalidate!", /* Function name in Scheme */
+            1, 0,      /* No. of required/optional args */
+            0,         /* Whether accepts "rest" arg */
+            (SCM handle), /* C argument list */
+            "Forget what is cached about the key @var{handle} refers to, for instance on a key-change notification.") /* Docstring */
+{
+  struct lkr_key_handle *kh = NULL;
+
+  SCM_ASSERT_TYPE(lkr_is_key_handle(handle), handle, SCM_ARG1, s_key_handle_invalidate_x, KEY_HANDLE_DESC);
+
+  kh = KEY_HANDLE(handle);
+  kh->description = SCM_BOOL_F;
+  kh->security = SCM_BOOL_F;
+
+  return SCM_UNSPECIFIED;
+}
+
+
+SCM_DEFINE (key_handle_invalidate_all_x,   /* Function name in C */
+            "key-handle-invalidate-all!", /* Function name in Scheme */
+            0, 0,      /* No. of required/optional args */
+            0,         /* Whether accepts "rest" arg */
+            (void), /* C argument list */
+            "Forget what is cached about every key.") /* Docstring */
+{
+  lkr_key_handles_changed();
+
+  return SCM_UNSPECIFIED;
+}
+
+
+/* ******************************************************************
+   Initialization
+*/
+
+void
+init_lkr_key_handle(void)
+{
+  key_handle_tag = scm_make_smob_type("key-handle", 0);
+  scm_set_smob_print(key_handle_tag, print_key_handle);
+  scm_set_smob_equalp(key_handle_tag, equalp_key_handle);
+
+  #include "keyhandle.x"
+}
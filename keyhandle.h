@@ -0,0 +1,41 @@
+/* Copyright (C) 2016 Kirk Zurell.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/* guile-linux-key-retention: key handles. */
+
+#ifndef GUILE_LKR_KEYHANDLE_H
+#define GUILE_LKR_KEYHANDLE_H
+
+#include <libguile.h>
+
+#include <keyutils.h>
+
+/* Whether x is a key handle. */
+int lkr_is_key_handle(SCM x);
+
+/* The serial of the key handle x, which must be a key handle. */
+key_serial_t lkr_key_handle_serial(SCM x);
+
+/* Called by the wrappers after they change a key's attributes.
+   Marks every cached description stale, so that it is fetched again
+   when next asked for. */
+void lkr_key_handles_changed(void);
+
+void init_lkr_key_handle(void);
+
+#endif /* GUILE_LKR_KEYHANDLE_H */
@@ -0,0 +1,59 @@
+/* Copyright (C) 2016 Kirk Zurell.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/* guile-lkr-upcall-launcher: request-key handler.
+
+   Does the same as the guile-lkr-upcall script, but starts faster:
+   the extension is linked in, so loading the module does not dlopen
+   it, and the upcall module is loaded from its installed .go file.
+
+   Invoked as: guile-lkr-upcall-launcher %k %t %d %c %S
+*/
+
+#include <libguile.h>
+
+void init_linux_key_retention(void);
+
+static void
+init_extension(void *unused)
+{
+  init_linux_key_retention();
+}
+
+static void
+inner_main(void *closure, int argc, char **argv)
+{
+  SCM upcall_main;
+
+  /* load-extension finds this registration instead of searching for
+     the shared library. */
+  scm_c_register_extension(NULL, "init_linux_key_retention", init_extension, NULL);
+
+  upcall_main = scm_c_public_ref("linux-key-retention upcall", "upcall-main");
+
+  scm_call_1(upcall_main, scm_cdr(scm_program_arguments()));
+}
+
+int
+main(int argc, char **argv)
+{
+  scm_boot_guile(argc, argv, inner_main, NULL);
+
+  /* Not reached. */
+  return 0;
+}
@@ -20,42 +20,162 @@
 
 #include <errno.h>
 #include <limits.h>
+#include <string.h>
+#include <wchar.h>
 
 #include <libguile.h>
 
 #include <keyutils.h>
 
+#include "arena.h"
+#include "async.h"
+#include "codec.h"
+#include "convert.h"
+#include "keyctl.h"
+#include "keyhandle.h"
+#include "stats.h"
+
 /* ******************************************************************
-   Support routines to match libguile usage. 
+   Payload buffers.
+
+   Payloads are staged in locked, per-thread buffers (see arena.c)
+   rather than in malloc'd strings, so that secrets are zeroed after
+   each call and steady-state calls do not allocate.
 */
 
-/* This is probably not the correct way to do this. */
-#define scm_is_undefined(x) (scm_is_eq(x, SCM_UNDEFINED))
+static void
+release_lkr_buffer(void *buf)
+{
+  lkr_arena_release((struct lkr_buffer *)buf);
+}
 
+/* Acquire a staging buffer of at least len bytes, released when the
+   current dynwind context is left. */
+static struct lkr_buffer *
+scm_dynwind_lkr_buffer(size_t len)
+{
+  struct lkr_buffer *buf = lkr_arena_acquire(len);
 
-#define KEY_SERIAL_DESC "NUM"
-#define STRING_DESC "STRING"
-#define BOOL_DESC "BOOL"
-#define OR_FALSE " or #f"
+  if(buf == NULL)
+    {
+      scm_report_out_of_memory();
+    }
 
-SCM 
-scm_from_key_serial_t(key_serial_t x)
+  scm_dynwind_unwind_handler(release_lkr_buffer, buf, SCM_F_WIND_EXPLICITLY);
+
+  return buf;
+}
+
+/* Make room for n more bytes at pos in buf, keeping what is there. */
+void
+lkr_stage_reserve(struct lkr_buffer *buf, size_t pos, size_t n)
 {
-  return scm_from_int((int)x);
+  if(pos + n > buf->size && lkr_arena_extend(buf, 2 * (pos + n), pos) < 0)
+    {
+      scm_report_out_of_memory();
+    }
 }
 
-key_serial_t
-scm_to_key_serial_t(SCM x)
+/* Append str to buf at *pos in the locale's encoding, NUL-terminated
+   if terminate is non-zero, and return the offset it starts at.
+
+   Characters are converted one at a time, straight into the buffer:
+   scm_to_locale_stringbuf would go through a malloc'd copy of its
+   own, which is freed without being zeroed. ASCII, which every locale
+   encodes as itself, is copied without conversion. */
+size_t
+lkr_stage_string(struct lkr_buffer *buf, size_t *pos, SCM str, int terminate,
+		 const char *subr)
 {
-  return scm_to_int(x);
+  size_t start = *pos;
+  size_t len = scm_c_string_length(str);
+  size_t i;
+  mbstate_t state;
+
+  memset(&state, 0, sizeof(state));
+
+  lkr_stage_reserve(buf, *pos, len + 1);
+
+  for(i = 0; i < len; i++)
+    {
+      scm_t_wchar c = SCM_CHAR(scm_c_string_ref(str, i));
+
+      if(c < 0x80)
+	{
+	  buf->data[(*pos)++] = (char)c;
+	}
+      else
+	{
+	  size_t n;
+
+	  /* This character, and the rest as ASCII. */
+	  lkr_stage_reserve(buf, *pos, MB_LEN_MAX + len - i);
+
+	  if((n = wcrtomb(buf->data + *pos, (wchar_t)c, &state)) == (size_t)-1)
+	    {
+	      buf->used = *pos;
+	      errno = EILSEQ;
+	      scm_syserror(subr);
+	    }
+
+	  *pos += n;
+	}
+    }
+
+  if(terminate)
+    {
+      buf->data[(*pos)++] = '\0';
+    }
+
+  buf->used = *pos;
+
+  return start;
 }
 
-int
-scm_is_key_serial_t(SCM x)
+/* Copy a string or bytevector payload into a staging buffer, and
+   store its length in *plen. Must be called within a dynwind
+   context. */
+static struct lkr_buffer *
+scm_to_lkr_payload(SCM payload, size_t *plen, const char *subr)
 {
-  return scm_is_number(x);
+  struct lkr_buffer *buf = NULL;
+  size_t len = 0;
+
+  if(scm_is_bytevector(payload))
+    {
+      len = SCM_BYTEVECTOR_LENGTH(payload);
+      buf = scm_dynwind_lkr_buffer(len);
+      memcpy(buf->data, SCM_BYTEVECTOR_CONTENTS(payload), len);
+    }
+  else
+    {
+      buf = scm_dynwind_lkr_buffer(0);
+      lkr_stage_string(buf, &len, payload, 0, subr);
+    }
+
+  buf->used = len;
+  *plen = len;
+
+  return buf;
 }
 
+/* A string from len bytes in the locale's encoding. ASCII is taken as
+   Latin-1, which libguile converts without going through the heap. */
+static SCM
+scm_from_lkr_locale_stringn(const char *s, size_t len)
+{
+  size_t i;
+
+  for(i = 0; i < len; i++)
+    {
+      if((unsigned char)s[i] >= 0x80)
+	{
+	  return scm_from_locale_stringn(s, len);
+	}
+    }
+
+  return scm_from_latin1_stringn(s, len);
+}
 
 
 /* ******************************************************************
@@ -72,37 +192,35 @@ SCM_DEFINE (add_key_wrapper,   /* Function name in C */
 {
   key_serial_t result = 0;
 
-  char *req_keytype = NULL;
-  char *req_description = NULL;
+  struct lkr_buffer *req_strings = NULL;
+  size_t req_keytype = 0;
+  size_t req_description = 0;
+  size_t req_pos = 0;
 
-  void * req_payload = NULL;
+  struct lkr_buffer *req_payload = NULL;
   size_t req_plen = 0;
   
   key_serial_t req_keyring = 0;
 
   SCM_ASSERT_TYPE(scm_is_string(keytype), keytype, SCM_ARG1, s_add_key_wrapper, STRING_DESC );
   SCM_ASSERT_TYPE(scm_is_string(description), description, SCM_ARG2, s_add_key_wrapper, STRING_DESC );
-  SCM_ASSERT_TYPE(scm_is_string(payload) 
+  SCM_ASSERT_TYPE(scm_is_payload(payload) 
 		  || scm_is_false(payload)
 		  || scm_is_undefined(payload),
-		  payload, SCM_ARG3, s_add_key_wrapper, STRING_DESC OR_FALSE );
+		  payload, SCM_ARG3, s_add_key_wrapper, PAYLOAD_DESC OR_FALSE );
   SCM_ASSERT_TYPE(scm_is_key_serial_t(keyring)
 		  || scm_is_undefined(keyring), 
 		  keyring, SCM_ARG4, s_add_key_wrapper, KEY_SERIAL_DESC );
 
   scm_dynwind_begin(0);
 
-  req_keytype = scm_to_locale_string(keytype);
-  scm_dynwind_free(req_keytype);
-
-  req_description = scm_to_locale_string(description);
-  scm_dynwind_free(req_description);
+  req_strings = scm_dynwind_lkr_buffer(0);
+  req_keytype = lkr_stage_string(req_strings, &req_pos, keytype, 1, s_add_key_wrapper);
+  req_description = lkr_stage_string(req_strings, &req_pos, description, 1, s_add_key_wrapper);
 
   if(!(scm_is_false(payload) || scm_is_undefined(payload)))
     {
-      req_payload = scm_to_locale_string(payload);
-      scm_dynwind_free(req_payload);
-      req_plen = strlen(req_payload);
+      req_payload = scm_to_lkr_payload(payload, &req_plen, s_add_key_wrapper);
     }
 
   if(scm_is_key_serial_t(keyring))
@@ -110,7 +228,11 @@ SCM_DEFINE (add_key_wrapper,   /* Function name in C */
       req_keyring = scm_to_key_serial_t(keyring);
     }
 
-  result = add_key(req_keytype, req_description, req_payload, req_plen, req_keyring);
+  result = lkr_stat(LKR_STAT_ADD_KEY,
+		    add_key(req_strings->data + req_keytype,
+			    req_strings->data + req_description,
+			    req_payload ? req_payload->data : NULL, req_plen,
+			    req_keyring));
 
   scm_dynwind_end();
 
@@ -133,34 +255,34 @@ SCM_DEFINE(request_key_wrapper,
 {
   key_serial_t result = 0;
 
-  char *req_keytype = NULL;
-  char *req_description = NULL;
-  void *req_callout_info = NULL;
+  struct lkr_buffer *req_strings = NULL;
+  size_t req_keytype = 0;
+  size_t req_description = 0;
+  size_t req_callout_info = 0;
+  size_t req_pos = 0;
   key_serial_t req_dest_keyring = 0;
+  long long start = 0;
 
   SCM_ASSERT_TYPE(scm_is_string(keytype), keytype, SCM_ARG1, s_request_key_wrapper, STRING_DESC );
   SCM_ASSERT_TYPE(scm_is_string(description), description, SCM_ARG2, s_request_key_wrapper, STRING_DESC );
   SCM_ASSERT_TYPE(scm_is_string(callout_info)
 		  || scm_is_false(callout_info)
 		  || scm_is_undefined(callout_info), 
-		  keytype, SCM_ARG3, s_request_key_wrapper, STRING_DESC OR_FALSE );
+		  callout_info, SCM_ARG3, s_request_key_wrapper, STRING_DESC OR_FALSE );
   SCM_ASSERT_TYPE(scm_is_key_serial_t(dest_keyring)
 		  || scm_is_false(dest_keyring)
 		  || scm_is_undefined(dest_keyring), 
-		  keytype, SCM_ARG4, s_request_key_wrapper, KEY_SERIAL_DESC OR_FALSE );
+		  dest_keyring, SCM_ARG4, s_request_key_wrapper, KEY_SERIAL_DESC OR_FALSE );
 
   scm_dynwind_begin(0);
 
-  req_keytype = scm_to_locale_string(keytype);
-  scm_dynwind_free(req_keytype);
+  req_strings = scm_dynwind_lkr_buffer(0);
+  req_keytype = lkr_stage_string(req_strings, &req_pos, keytype, 1, s_request_key_wrapper);
+  req_description = lkr_stage_string(req_strings, &req_pos, description, 1, s_request_key_wrapper);
 
-  req_description = scm_to_locale_string(description);
-  scm_dynwind_free(req_description);
-
-  if(!(scm_is_false(callout_info) || scm_is_undefined(callout_info)))
+  if(scm_is_string(callout_info))
     {
-      req_callout_info = scm_to_locale_string(callout_info);
-      scm_dynwind_free(req_callout_info);
+      req_callout_info = lkr_stage_string(req_strings, &req_pos, callout_info, 1, s_request_key_wrapper);
     }
 
   if(scm_is_key_serial_t(dest_keyring))
@@ -168,7 +290,13 @@ SCM_DEFINE(request_key_wrapper,
       req_dest_keyring = scm_to_key_serial_t(dest_keyring);
     }
 
-  result = request_key(req_keytype, req_description, req_callout_info, req_dest_keyring);
+  start = lkr_stat_now_ns();
+  result = lkr_stat(LKR_STAT_REQUEST_KEY,
+		    request_key(req_strings->data + req_keytype,
+				req_strings->data + req_description,
+				scm_is_string(callout_info) ? req_strings->data + req_callout_info : NULL,
+				req_dest_keyring));
+  lkr_stat_request_key_ns(lkr_stat_now_ns() - start);
 
   scm_dynwind_end();
   
@@ -181,230 +309,71 @@ SCM_DEFINE(request_key_wrapper,
 }
 
 
-
-// key_serial_t keyctl(KEYCTL_GET_KEYRING_ID, key_serial_t id, int create);
-/* SCM */
-SCM_DEFINE (keyctl_get_keyring_ID_wrapper,   /* Function name in C */
-            "keyctl-get-keyring-id", /* Function name in Scheme */
-            1, 1,      /* No. of required/optional args */
-            0,         /* Whether accepts "rest" arg */
-            (SCM id, SCM create), /* C argument list */
-            "Get the ID of a keyring.") /* Docstring */
-
+/* Call keyctl(cmd, key, buffer, buflen) for one of the commands that
+   read into a buffer, with a staging buffer that is grown until what
+   is read fits. Returns the length read, or -1 with errno set. Must be
+   called within a dynwind context. */
+static long
+read_lkr_buffer(int cmd, key_serial_t key, struct lkr_buffer **buf)
 {
-  key_serial_t result = 0;
-
-  key_serial_t req_id = 0;
-  int req_create = 0;
-  
-  SCM_ASSERT_TYPE(scm_is_key_serial_t(id), id, SCM_ARG1, s_keyctl_get_keyring_ID_wrapper, KEY_SERIAL_DESC );
-  SCM_ASSERT_TYPE(scm_is_bool(create)
-		  || scm_is_undefined(create), 
-		  create, SCM_ARG2, s_keyctl_get_keyring_ID_wrapper, BOOL_DESC);
-  
-  req_id = scm_to_key_serial_t(id);
+  long result = 0;
 
-  if(scm_is_bool(create))
-    {
-      req_create = scm_to_bool(create);
-    }
+  *buf = scm_dynwind_lkr_buffer(0);
 
-  result = keyctl(KEYCTL_GET_KEYRING_ID, req_id, req_create);
-  
-  if(result < 0) //ENOKEY
+  /* These return the full length, even if it did not fit: grow and
+     try again. */
+  for(;;)
     {
-      scm_syserror(s_keyctl_get_keyring_ID_wrapper);
-    }
+      result = keyctl(cmd, key, (*buf)->data, (*buf)->size);
 
-  return scm_from_key_serial_t(result);
-}
-
-// key_serial_t keyctl(KEYCTL_JOIN_SESSION_KEYRING, const char *name);
-/* SCM */
-SCM_DEFINE (keyctl_join_session_keyring_wrapper,   /* Function name in C */
-            "keyctl-join-session-keyring", /* Function name in Scheme */
-            0, 1,      /* No. of required/optional args */
-            0,         /* Whether accepts "rest" arg */
-            (SCM name), /* C argument list */
-            "Join session keyring.") /* Docstring */
-{
-  key_serial_t result = 0;
-  char *req_name = NULL;
-  
-  SCM_ASSERT_TYPE(scm_is_string(name) 
-		  || scm_is_false(name)
-		  || scm_is_undefined(name), 
-		  name, SCM_ARG1, s_keyctl_join_session_keyring_wrapper, STRING_DESC OR_FALSE);
-  
-  scm_dynwind_begin(0);
+      if(result < 0 || (size_t)result <= (*buf)->size)
+	{
+	  break;
+	}
 
-  if(scm_is_string(name))
-    {
-      req_name = scm_to_locale_string(name);
-      scm_dynwind_free(req_name);      
+      if(lkr_arena_grow(*buf, result) < 0)
+	{
+	  scm_report_out_of_memory();
+	}
     }
 
-  result = keyctl(KEYCTL_JOIN_SESSION_KEYRING, req_name);
-  
-  scm_dynwind_end();
-
-  if(result < 0) 
+  if(result >= 0)
     {
-      scm_syserror(s_keyctl_join_session_keyring_wrapper);
+      (*buf)->used = result;
     }
 
-  return scm_from_key_serial_t(result);
+  return result;
 }
 
-
-// long keyctl(KEYCTL_UPDATE, key_serial_t key, const void *payload, size_t plen);
-/* SCM */
-SCM_DEFINE (keyctl_update_wrapper,   /* Function name in C */
-            "keyctl-update", /* Function name in Scheme */
-            1, 1,      /* No. of required/optional args */
-            0,         /* Whether accepts "rest" arg */
-            (SCM key, SCM payload), /* C argument list */
-            "Update a key's payload") /* Docstring */
+/* A NUL-terminated string read with read_lkr_buffer. */
+static SCM
+read_lkr_string(int cmd, enum lkr_stat_op op, SCM key, const char *subr)
 {
   long result = 0;
+  SCM value = SCM_BOOL_F;
 
   key_serial_t req_key = 0;
+  struct lkr_buffer *req_buffer = NULL;
 
-  void * req_payload = NULL;
-  size_t req_plen = 0;
-  
-  SCM_ASSERT_TYPE(scm_is_key_serial_t(key), key, SCM_ARG1, s_keyctl_update_wrapper, KEY_SERIAL_DESC );
-  SCM_ASSERT_TYPE(scm_is_string(payload)
-		  || scm_is_false(payload)
-		  || scm_is_undefined(payload), 
-		  payload, SCM_ARG2, s_keyctl_update_wrapper, STRING_DESC );
-  
-  scm_dynwind_begin(0);
-
-  req_key = scm_to_key_serial_t(key);
-
-  if(scm_is_string(payload))
-    {
-      req_payload = scm_to_locale_string(payload);
-      scm_dynwind_free(req_payload);
-      req_plen = strlen(req_payload);
-    }
-
-  result = keyctl(KEYCTL_UPDATE, req_key, req_payload, req_plen);
-
-  scm_dynwind_end();
-
-  if(result < 0)
-    {
-      scm_syserror(s_keyctl_update_wrapper);
-    }
-
-  return scm_from_long(result);
-}
-
-// long keyctl(KEYCTL_REVOKE, key_serial_t key);
-/* SCM */
-SCM_DEFINE (keyctl_revoke_wrapper,   /* Function name in C */
-            "keyctl-revoke", /* Function name in Scheme */
-            1, 0,      /* No. of required/optional args */
-            0,         /* Whether accepts "rest" arg */
-            (SCM key), /* C argument list */
-            "Revoke a key.") /* Docstring */
-{ 
-  long result;
-  
-  key_serial_t req_key = 0;
-
-  SCM_ASSERT_TYPE(scm_is_key_serial_t(key), key, SCM_ARG1, s_keyctl_revoke_wrapper, KEY_SERIAL_DESC);
-  
-  req_key = scm_to_key_serial_t(key);
-
-  result = keyctl(KEYCTL_REVOKE, req_key);
-  
-  if(result < 0)
-    {
-      scm_syserror(s_keyctl_revoke_wrapper);
-    }
-
-  return result == 0 ? SCM_BOOL_T : scm_from_long(result);
-}
-
-
-// long keyctl(KEYCTL_CHOWN, key_serial_t key, uid_t uid, gid_t gid);
-/* SCM */
-SCM_DEFINE (keyctl_chown_wrapper,   /* Function name in C */
-            "keyctl-chown", /* Function name in Scheme */
-            1, 2,      /* No. of required/optional args */
-            0,         /* Whether accepts "rest" arg */
-            (SCM key, SCM uid, SCM gid), /* C argument list */
-            "Set a key's uid and gid.") /* Docstring */
-{
-  long result = 0;
-  key_serial_t req_key = 0;
-  uid_t req_uid = -1;
-  gid_t req_gid = -1;
-
-  SCM_ASSERT_TYPE(scm_is_key_serial_t(key), key, SCM_ARG1, s_keyctl_chown_wrapper, KEY_SERIAL_DESC);
-  SCM_ASSERT_TYPE(scm_is_number(uid) 
-		  || scm_is_false(uid) 
-		  || scm_is_undefined(uid),
-		  uid, SCM_ARG2, s_keyctl_chown_wrapper, KEY_SERIAL_DESC OR_FALSE);
-  SCM_ASSERT_TYPE(scm_is_number(gid)
-		  || scm_is_false(gid)
-		  || scm_is_undefined(gid),
-		  gid, SCM_ARG3, s_keyctl_chown_wrapper, KEY_SERIAL_DESC OR_FALSE);
+  SCM_ASSERT_TYPE(scm_is_key_serial_t(key), key, SCM_ARG1, subr, KEY_SERIAL_DESC);
 
   req_key = scm_to_key_serial_t(key);
 
-  if(scm_is_number(uid))
-    {
-      req_uid = (uid_t)scm_to_signed_integer(uid, -1, INT_MAX);
-    }
-
-  if(scm_is_number(gid))
-    {
-      req_gid = (gid_t)scm_to_signed_integer(uid, -1, INT_MAX);
-    }
+  scm_dynwind_begin(0);
 
-  result = keyctl(KEYCTL_CHOWN, req_key, req_uid, req_gid);
+  result = lkr_stat(op, read_lkr_buffer(cmd, req_key, &req_buffer));
 
   if(result < 0)
     {
-      scm_syserror(s_keyctl_chown_wrapper);
+      scm_syserror(subr);
     }
 
-  return scm_from_long(result);
-}
-
-
-// long keyctl(KEYCTL_SETPERM, key_serial_t key, key_perm_t perm);
-/* SCM */
-SCM_DEFINE (keyctl_setperm_wrapper,   /* Function name in C */
-            "keyctl-setperm", /* Function name in Scheme */
-            2, 0,      /* No. of required/optional args */
-            0,         /* Whether accepts "rest" arg */
-            (SCM key, SCM perm), /* C argument list */
-            "Set a key's permissions.") /* Docstring */
-{
-  long result = 0;
-  key_serial_t req_key = 0;
-  key_perm_t req_perm = 0;
-
-  SCM_ASSERT_TYPE(scm_is_key_serial_t(key), key, SCM_ARG1, s_keyctl_setperm_wrapper, KEY_SERIAL_DESC);
-  SCM_ASSERT_TYPE(scm_is_number(perm), perm, SCM_ARG2, s_keyctl_setperm_wrapper, KEY_SERIAL_DESC);
-
-  req_key = scm_to_key_serial_t(key);
-
-  req_perm = (key_perm_t)scm_to_uint32(perm);
-
-  result = keyctl(KEYCTL_SETPERM, req_key, req_perm);
+  // Remove final zero.
+  value = scm_from_lkr_locale_stringn(req_buffer->data, result > 0 ? result - 1 : 0);
 
-  if(result < 0)
-    {
-      scm_syserror(s_keyctl_setperm_wrapper);
-    }
+  scm_dynwind_end();
 
-  return scm_from_long(result);
+  return value;
 }
 
 
@@ -417,169 +386,7 @@ SCM_DEFINE (keyctl_describe_wrapper,   /* Function name in C */
             (SCM key), /* C argument list */
             "Describe a key.") /* Docstring */
 {
-  long result = 0;
-
-  key_serial_t req_key = 0;
-  char req_buffer[256];
-
-  SCM_ASSERT_TYPE(scm_is_key_serial_t(key), key, SCM_ARG1, s_keyctl_describe_wrapper, KEY_SERIAL_DESC);
-
-  req_key = scm_to_key_serial_t(key);
-
-  result = keyctl(KEYCTL_DESCRIBE, req_key, req_buffer, 256);
-
-  if(result < 0)
-    {
-      scm_syserror(s_keyctl_describe_wrapper);
-    }
-
-  result = result > 256 ? 256 : result;
-
-  // Remove final zero.
-  return scm_from_locale_stringn(req_buffer, result - 1);
-}
-
-
-// long keyctl(KEYCTL_CLEAR, key_serial_t keyring);
-/* SCM */
-SCM_DEFINE (keyctl_clear_wrapper,   /* Function name in C */
-            "keyctl-clear", /* Function name in Scheme */
-            1, 0,      /* No. of required/optional args */
-            0,         /* Whether accepts "rest" arg */
-            (SCM keyring), /* C argument list */
-            "Clear a keyring.") /* Docstring */
-{
-  long result = 0;
-
-  key_serial_t req_keyring = 0;
-  
-  SCM_ASSERT_TYPE(scm_is_key_serial_t(keyring), keyring, SCM_ARG1, s_keyctl_clear_wrapper, KEY_SERIAL_DESC);
-  
-  req_keyring = scm_to_key_serial_t(keyring);
-
-  result = keyctl(KEYCTL_CLEAR, req_keyring);
-
-  if(result < 0)
-    {
-      scm_syserror(s_keyctl_clear_wrapper);
-    }
-  
-  return SCM_BOOL_T;
-}
-
-
-
-// long keyctl(KEYCTL_LINK, key_serial_t keyring, key_serial_t key);
-/* SCM */
-SCM_DEFINE (keyctl_link_wrapper,   /* Function name in C */
-            "keyctl-link", /* Function name in Scheme */
-            2, 0,      /* No. of required/optional args */
-            0,         /* Whether accepts "rest" arg */
-            (SCM keyring, SCM key), /* C argument list */
-            "Link a key to a keyring.") /* Docstring */
-{
-  long result = 0;
-  key_serial_t req_keyring = 0;
-  key_serial_t req_key = 0;
-
-  SCM_ASSERT_TYPE(scm_is_key_serial_t(keyring), keyring, SCM_ARG1, s_keyctl_link_wrapper, KEY_SERIAL_DESC);
-  SCM_ASSERT_TYPE(scm_is_key_serial_t(key), key, SCM_ARG2, s_keyctl_link_wrapper, KEY_SERIAL_DESC);
-
-  req_keyring = scm_to_key_serial_t(keyring);
-
-  req_key = scm_to_key_serial_t(key);
-
-  result = keyctl(KEYCTL_LINK, req_keyring, req_key);
-
-  if(result < 0)
-    {
-      scm_syserror(s_keyctl_link_wrapper);
-    }
-  
-  return result ? scm_from_long(result) : SCM_BOOL_T;
-}
-
-
-// long keyctl(KEYCTL_UNLINK, key_serial_t keyring, key_serial_t key);
-/* SCM */
-SCM_DEFINE (keyctl_unlink_wrapper,   /* Function name in C */
-            "keyctl-unlink", /* Function name in Scheme */
-            2, 0,      /* No. of required/optional args */
-            0,         /* Whether accepts "rest" arg */
-            (SCM keyring, SCM key), /* C argument list */
-            "Unlink a key.") /* Docstring */
-{
-  long result = 0;
-  key_serial_t req_keyring = 0;
-  key_serial_t req_key = 0;
-
-  SCM_ASSERT_TYPE(scm_is_key_serial_t(keyring), keyring, SCM_ARG1, s_keyctl_unlink_wrapper, KEY_SERIAL_DESC);
-  SCM_ASSERT_TYPE(scm_is_key_serial_t(key), key, SCM_ARG2, s_keyctl_unlink_wrapper, KEY_SERIAL_DESC);
-
-  req_keyring = scm_to_key_serial_t(keyring);
-
-  req_key = scm_to_key_serial_t(key);
-
-  result = keyctl(KEYCTL_UNLINK, req_keyring, req_key);
-
-  if(result < 0)
-    {
-      scm_syserror(s_keyctl_unlink_wrapper);
-    }
-  
-  return result ? scm_from_long(result) : SCM_BOOL_T;
-}
-
-
-
-// key_serial_t keyctl(KEYCTL_SEARCH, key_serial_t keyring,  const char *type, const char *description,  key_serial_t dest_keyring);
-/* SCM */
-SCM_DEFINE (keyctl_search_wrapper,   /* Function name in C */
-            "keyctl-search", /* Function name in Scheme */
-            3, 1,      /* No. of required/optional args */
-            0,         /* Whether accepts "rest" arg */
-            (SCM keyring, SCM keytype, SCM description, SCM dest_keyring), /* C argument list */
-            "Search for a key by description.") /* Docstring */
-{
-  key_serial_t result = 0;
-  key_serial_t req_keyring = 0;
-  char * req_keytype = NULL;
-  char * req_description = NULL;
-  key_serial_t req_dest_keyring = 0;
-
-  SCM_ASSERT_TYPE(scm_is_key_serial_t(keyring), keyring, SCM_ARG1, s_keyctl_search_wrapper, KEY_SERIAL_DESC);
-  SCM_ASSERT_TYPE(scm_is_string(keytype), keytype, SCM_ARG2, s_keyctl_search_wrapper, STRING_DESC);
-  SCM_ASSERT_TYPE(scm_is_string(description), description, SCM_ARG3, s_keyctl_search_wrapper, STRING_DESC);
-  SCM_ASSERT_TYPE(scm_is_key_serial_t(dest_keyring) 
-		  || scm_is_false(dest_keyring)
-		  || scm_is_undefined(dest_keyring), 
-		  dest_keyring, SCM_ARG4, s_keyctl_search_wrapper, KEY_SERIAL_DESC);
-  
-  scm_dynwind_begin(0);
-
-  req_keyring = scm_to_key_serial_t(keyring);
-  
-  req_keytype = scm_to_locale_string(keytype);
-  scm_dynwind_free(req_keytype);
-
-  req_description = scm_to_locale_string(description);
-  scm_dynwind_free(req_description);
-
-  if(scm_is_key_serial_t(dest_keyring))
-    {
-      req_dest_keyring = scm_to_key_serial_t(dest_keyring);
-    }
-
-  result = keyctl(KEYCTL_SEARCH, req_keyring, req_keytype, req_description, req_dest_keyring);
-
-  scm_dynwind_end();
-
-  if(result < 0)
-    {
-      scm_syserror(s_keyctl_search_wrapper);
-    }
-
-  return result ? scm_from_key_serial_t(result) : SCM_BOOL_T;
+  return read_lkr_string(KEYCTL_DESCRIBE, LKR_STAT_DESCRIBE, key, s_keyctl_describe_wrapper);
 }
 
 
@@ -593,266 +400,72 @@ SCM_DEFINE (keyctl_read_wrapper,   /* Function name in C */
             "Read a key.") /* Docstring */
 {
   long result = 0;
+  SCM value = SCM_BOOL_F;
 
   key_serial_t req_key = 0;
-  char req_buffer[256];
+  struct lkr_buffer *req_buffer = NULL;
   
   SCM_ASSERT_TYPE(scm_is_key_serial_t(key), key, SCM_ARG1, s_keyctl_read_wrapper, KEY_SERIAL_DESC);
 
   req_key = scm_to_key_serial_t(key);
 
-  result = keyctl(KEYCTL_READ, req_key, req_buffer, 256);
-
-  if(result < 0)
-    {
-      scm_syserror(s_keyctl_read_wrapper);
-    }
-
-  result = result > 256 ? 256 : result;
-
-  return result ? scm_from_locale_stringn(req_buffer, result) : SCM_BOOL_F;
-}
-
-
-
-// long keyctl(KEYCTL_INSTANTIATE, key_serial_t key, const void *payload, size_t plen, key_serial_t keyring);
-/* SCM */
-SCM_DEFINE (keyctl_instantiate_wrapper,   /* Function name in C */
-            "keyctl-instantiate", /* Function name in Scheme */
-            2, 1,      /* No. of required/optional args */
-            0,         /* Whether accepts "rest" arg */
-            (SCM key, SCM payload, SCM keyring), /* C argument list */
-            "Instantiate a requested key.") /* Docstring */
-{
-  long result = 0;
-
-  key_serial_t req_key = 0;
-  key_serial_t req_keyring = 0;
-
-  void * req_payload = NULL;
-  size_t req_plen = 0;
-
-  SCM_ASSERT_TYPE(scm_is_key_serial_t(key), key, SCM_ARG1, s_keyctl_instantiate_wrapper, KEY_SERIAL_DESC);
-  SCM_ASSERT_TYPE(scm_is_string(payload), payload, SCM_ARG2, s_keyctl_instantiate_wrapper, STRING_DESC);
-  SCM_ASSERT_TYPE(scm_is_key_serial_t(keyring)
-	     || scm_is_false(keyring)
-	     || scm_is_undefined(keyring),
-	     keyring, SCM_ARG3, s_keyctl_instantiate_wrapper, KEY_SERIAL_DESC OR_FALSE );
-
-
   scm_dynwind_begin(0);
 
-  if(!(scm_is_false(payload) || scm_is_undefined(payload)))
-    {
-      req_payload = scm_to_locale_string(payload);
-      scm_dynwind_free(req_payload);
-      req_plen = strlen(req_payload);
-    }
-
-  if(scm_is_key_serial_t(keyring))
-    {
-      req_keyring = scm_to_key_serial_t(keyring);
-    }
-
-  result = keyctl(KEYCTL_INSTANTIATE,
-		  req_key,
-		  req_payload,
-		  req_plen,
-		  req_keyring);
-
-  scm_dynwind_end();
+  result = lkr_stat(LKR_STAT_READ, read_lkr_buffer(KEYCTL_READ, req_key, &req_buffer));
 
   if(result < 0)
     {
-      scm_syserror(s_keyctl_instantiate_wrapper);
-    }
-  
-  return scm_from_key_serial_t(result);
-}
-
-
-// long keyctl(KEYCTL_NEGATE, key_serial_t key, unsigned timeout, key_serial_t keyring);
-/* SCM */
-SCM_DEFINE (keyctl_negate_wrapper,   /* Function name in C */
-            "keyctl-negate", /* Function name in Scheme */
-            2, 1,      /* No. of required/optional args */
-            0,         /* Whether accepts "rest" arg */
-            (SCM key, SCM timeout, SCM keyring), /* C argument list */
-            "Negate a key.") /* Docstring */
-{
-  long result = 0;
-
-  key_serial_t req_key = 0;
-  unsigned req_timeout = 0;
-  key_serial_t req_keyring = 0;
-
-  SCM_ASSERT_TYPE(scm_is_key_serial_t(key), key, SCM_ARG1, s_keyctl_negate_wrapper, KEY_SERIAL_DESC );  
-  SCM_ASSERT_TYPE(scm_is_number(timeout), timeout, SCM_ARG2, s_keyctl_negate_wrapper, KEY_SERIAL_DESC );
-  SCM_ASSERT_TYPE(scm_is_key_serial_t(keyring) 
-		  || scm_is_false(keyring)
-		  || scm_is_undefined(keyring), 
-		  keyring, SCM_ARG3, s_keyctl_negate_wrapper, KEY_SERIAL_DESC OR_FALSE );  
-
-  req_key = scm_to_key_serial_t(key);
-
-  req_timeout = scm_to_unsigned_integer(timeout, 0, INT_MAX);
-
-  if(scm_is_key_serial_t(keyring))
-    {
-      req_keyring = scm_to_key_serial_t(keyring);
+      scm_syserror(s_keyctl_read_wrapper);
     }
 
-  result = keyctl(KEYCTL_NEGATE, req_key, req_timeout, req_keyring);
-
-  if(result < 0)
+  if(result)
     {
-      scm_syserror(s_keyctl_negate_wrapper);
+      value = scm_from_lkr_locale_stringn(req_buffer->data, result);
     }
 
-  // What does this result mean?
-  return scm_from_long(result);
-}
-
-
-// long keyctl(KEYCTL_REJECT, key_serial_t key, unsigned timeout, unsigned error, key_serial_t keyring);
-/* SCM */
-SCM_DEFINE (keyctl_reject_wrapper,   /* Function name in C */
-            "keyctl-reject", /* Function name in Scheme */
-            3, 1,      /* No. of required/optional args */
-            0,         /* Whether accepts "rest" arg */
-            (SCM key, SCM timeout, SCM error, SCM keyring), /* C argument list */
-            "Rejects a key.") /* Docstring */
-{
-  long result = 0;
-
-  key_serial_t req_key = 0;
-  unsigned req_timeout = 0;
-  unsigned req_error = 0;
-  key_serial_t req_keyring = 0;
-
-  SCM_ASSERT_TYPE(scm_is_key_serial_t(key), key, SCM_ARG1, s_keyctl_reject_wrapper, KEY_SERIAL_DESC );  
-  SCM_ASSERT_TYPE(scm_is_number(timeout), timeout, SCM_ARG2, s_keyctl_reject_wrapper, KEY_SERIAL_DESC );
-  SCM_ASSERT_TYPE(scm_is_number(error), error, SCM_ARG3, s_keyctl_reject_wrapper, KEY_SERIAL_DESC );
-  SCM_ASSERT_TYPE(scm_is_key_serial_t(keyring) 
-		  || scm_is_false(keyring)
-		  || scm_is_undefined(keyring), 
-		  keyring, SCM_ARG4, s_keyctl_reject_wrapper, KEY_SERIAL_DESC OR_FALSE );  
-
-  req_key = scm_to_key_serial_t(key);
-
-  req_timeout = scm_to_unsigned_integer(timeout, 0, INT_MAX);
-
-  req_error = scm_to_unsigned_integer(error, 0, INT_MAX);
-
-  if(scm_is_key_serial_t(keyring))
-    {
-      req_keyring = scm_to_key_serial_t(keyring);
-    }
-
-  result = keyctl(KEYCTL_NEGATE, req_key, req_timeout, req_keyring);
-
-  if(result < 0)
-    {
-      scm_syserror(s_keyctl_reject_wrapper);
-    }
+  scm_dynwind_end();
 
-  return scm_from_long(result);
+  return value;
 }
 
 
-// long keyctl(KEYCTL_SET_REQKEY_KEYRING, int reqkey_defl);
+// long keyctl(KEYCTL_READ, key_serial_t keyring, char *buffer, size_t buflen);
 /* SCM */
-SCM_DEFINE (keyctl_set_reqkey_keyring_wrapper,   /* Function name in C */
-            "keyctl-set-reqkey-keyring", /* Function name in Scheme */
+SCM_DEFINE (keyctl_read_bytevector_wrapper,   /* Function name in C */
+            "keyctl-read-bytevector", /* Function name in Scheme */
             1, 0,      /* No. of required/optional args */
             0,         /* Whether accepts "rest" arg */
-            (SCM reqkey_defl), /* C argument list */
-            "Sets a requested key's keyring.") /* Docstring */
-{
-  long result = 0;
-
-  int req_reqkey_defl = 0;
-
-  SCM_ASSERT_TYPE(scm_is_signed_integer(reqkey_defl, INT_MIN, INT_MAX), 
-		  reqkey_defl, SCM_ARG1, s_keyctl_set_reqkey_keyring_wrapper, KEY_SERIAL_DESC );
-
-  req_reqkey_defl = scm_to_signed_integer(reqkey_defl, INT_MIN, INT_MAX);
-
-  result = keyctl(KEYCTL_SET_REQKEY_KEYRING, req_reqkey_defl);
-
-  if(result < 0)
-    {
-      scm_syserror(s_keyctl_set_reqkey_keyring_wrapper);
-    }
-
-  return scm_from_long(result);
-}
-
-
-// long keyctl(KEYCTL_SET_TIMEOUT, key_serial_t key, unsigned timeout);
-/* SCM */
-SCM_DEFINE (keyctl_set_timeout_wrapper,   /* Function name in C */
-            "keyctl-set-timeout", /* Function name in Scheme */
-            2, 0,      /* No. of required/optional args */
-            0,         /* Whether accepts "rest" arg */
-            (SCM key, SCM timeout), /* C argument list */
-            "Sets a key's timeout.") /* Docstring */
+            (SCM key), /* C argument list */
+            "Read a key's payload as bytes.") /* Docstring */
 {
   long result = 0;
+  SCM value = SCM_BOOL_F;
 
   key_serial_t req_key = 0;
-  /* KEYCTL_SET_TIMEOUT parameter is unsigned implied int. */
-  unsigned req_timeout = 0;
+  struct lkr_buffer *req_buffer = NULL;
 
-  SCM_ASSERT_TYPE(scm_is_key_serial_t(key), key, SCM_ARG1, s_keyctl_set_timeout_wrapper, KEY_SERIAL_DESC );  
-  SCM_ASSERT_TYPE(scm_is_unsigned_integer(timeout, 0, INT_MAX), timeout, SCM_ARG2, s_keyctl_set_timeout_wrapper, KEY_SERIAL_DESC );
+  SCM_ASSERT_TYPE(scm_is_key_serial_t(key), key, SCM_ARG1, s_keyctl_read_bytevector_wrapper, KEY_SERIAL_DESC);
 
   req_key = scm_to_key_serial_t(key);
 
-  req_timeout = scm_to_unsigned_integer(timeout, 0, INT_MAX); // TODO: check range.
+  scm_dynwind_begin(0);
+
+  result = lkr_stat(LKR_STAT_READ_BYTEVECTOR, read_lkr_buffer(KEYCTL_READ, req_key, &req_buffer));
 
-  result = keyctl(KEYCTL_SET_TIMEOUT, req_key, req_timeout); 
-   
   if(result < 0)
     {
-      scm_syserror(s_keyctl_set_timeout_wrapper);
+      scm_syserror(s_keyctl_read_bytevector_wrapper);
     }
 
-  return result ? scm_from_long(result) : SCM_BOOL_T;
-}
-
-
-// long keyctl(KEYCTL_ASSUME_AUTHORITY, key_serial_t key);
-/* SCM */
-SCM_DEFINE (keyctl_assume_authority_wrapper,   /* Function name in C */
-            "keyctl-assume-authority", /* Function name in Scheme */
-            0, 1,      /* No. of required/optional args */
-            0,         /* Whether accepts "rest" arg */
-            (SCM key), /* C argument list */
-            "Assumes authority over a key.") /* Docstring */
-{
-  long result = 0;
-
-  key_serial_t req_key = 0;
-
-  SCM_ASSERT_TYPE(scm_is_key_serial_t(key)
-		  || scm_is_false(key)
-		  || scm_is_undefined(key), 
-		  key, SCM_ARG1, s_keyctl_assume_authority_wrapper, KEY_SERIAL_DESC );  
-  
-  if(scm_is_key_serial_t(key))
+  if(result)
     {
-      req_key = scm_to_key_serial_t(key);
+      value = scm_c_make_bytevector(result);
+      memcpy(SCM_BYTEVECTOR_CONTENTS(value), req_buffer->data, result);
     }
 
-  result = keyctl(KEYCTL_ASSUME_AUTHORITY, req_key);
+  scm_dynwind_end();
 
-  if(result < 0)
-    {
-      scm_syserror(s_keyctl_assume_authority_wrapper);
-    }
-  
-  return result ? scm_from_long(result) : SCM_BOOL_T ;
+  return value;
 }
 
 
@@ -865,76 +478,262 @@ SCM_DEFINE (keyctl_get_security_wrapper,   /* Function name in C */
             (SCM key), /* C argument list */
             "Gets the security descriptor for a key.") /* Docstring */
 {
-  long result = 0;
+  return read_lkr_string(KEYCTL_GET_SECURITY, LKR_STAT_GET_SECURITY, key,
+			 s_keyctl_get_security_wrapper);
+}
 
-  key_serial_t req_key = 0;
-  char req_buffer[256];
 
-  SCM_ASSERT_TYPE(scm_is_key_serial_t(key), key, SCM_ARG1, s_keyctl_get_security_wrapper, KEY_SERIAL_DESC);
+/* ******************************************************************
+   Wrappers generated from LKR_KEYCTL_OPS (see keyctl.h).
 
-  req_key = scm_to_key_serial_t(key);
+   guile-snarf takes one definition per line, so these are registered
+   by hand in init_linux_key_retention, rather than with SCM_DEFINE.
+*/
 
-  result = keyctl(KEYCTL_GET_SECURITY, req_key, req_buffer, 256);
+/* The strings and payloads of one call, staged in one buffer. Each
+   argument is kept as an offset, as staging a later one may move the
+   buffer. */
+struct lkr_stage
+{
+  struct lkr_buffer *buf;
+  size_t pos;
+};
 
-  if(result < 0)
+struct lkr_staged
+{
+  size_t offset;
+  size_t len;
+  int present;
+};
+
+/* Stage x, a string or bytevector, or leave it absent if it is
+   neither. Strings are NUL-terminated if terminate is non-zero. */
+static struct lkr_staged
+lkr_stage_arg(struct lkr_stage *stage, SCM x, int terminate, const char *subr)
+{
+  struct lkr_staged staged = { 0, 0, 0 };
+
+  if(scm_is_bytevector(x))
     {
-      scm_syserror(s_keyctl_get_security_wrapper);
+      staged.len = SCM_BYTEVECTOR_LENGTH(x);
+      lkr_stage_reserve(stage->buf, stage->pos, staged.len);
+      memcpy(stage->buf->data + stage->pos, SCM_BYTEVECTOR_CONTENTS(x), staged.len);
+      staged.offset = stage->pos;
+      stage->pos += staged.len;
+      stage->buf->used = stage->pos;
+      staged.present = 1;
+    }
+  else if(scm_is_string(x))
+    {
+      staged.offset = lkr_stage_string(stage->buf, &stage->pos, x, terminate, subr);
+      staged.len = stage->pos - staged.offset - (terminate ? 1 : 0);
+      staged.present = 1;
     }
-  
-  result = result > 256 ? 256 : result;
 
-  // Remove final zero.
-  return scm_from_locale_stringn(req_buffer, result - 1);
+  return staged;
 }
 
-
-// long keyctl(KEYCTL_SESSION_TO_PARENT); 
-/* SCM */
-SCM_DEFINE (keyctl_session_to_parent_wrapper,   /* Function name in C */
-            "keyctl-session-to-parent", /* Function name in Scheme */
-            0, 0,      /* No. of required/optional args */
-            0,         /* Whether accepts "rest" arg */
-            (void), /* C argument list */
-            "Map session keychain to parent.") /* Docstring */
+/* Open the dynwind context that the staging buffer is released in, if
+   the call stages anything. */
+static inline void
+lkr_stage_begin(struct lkr_stage *stage, int staged)
 {
-  long result = 0;
-
-  result = keyctl(KEYCTL_SESSION_TO_PARENT);
-
-  if(result < 0)
+  if(staged)
     {
-      scm_syserror(s_keyctl_session_to_parent_wrapper);
+      scm_dynwind_begin(0);
+      stage->buf = scm_dynwind_lkr_buffer(0);
     }
-
-  return result ? scm_from_long(result) : SCM_BOOL_T;
 }
 
+#define LKR_STRIP(...) __VA_ARGS__
+#define LKR_CAT(a, b) LKR_CAT_I(a, b)
+#define LKR_CAT_I(a, b) a##b
+
+/* The number of arguments in a table line's argument list. An empty
+   list counts as one empty argument, which is told from a real one,
+   (kind, name), by whether LKR_NONEMPTY is invoked on it. */
+#define LKR_ARITY(args) LKR_ARITY_I args
+#define LKR_ARITY_I(...) LKR_ARITY_II(__VA_ARGS__, 4, 3, 2, LKR_ARITY_ONE(__VA_ARGS__), _)
+#define LKR_ARITY_II(...) LKR_ARITY_III(__VA_ARGS__)
+#define LKR_ARITY_III(a, b, c, d, n, ...) n
+#define LKR_ARITY_ONE(...) LKR_ARITY_ONE_I(__VA_ARGS__, _)
+#define LKR_ARITY_ONE_I(first, ...) LKR_CAT(LKR_ARITY_ONE_, LKR_NONEMPTY first)
+#define LKR_NONEMPTY(kind, name) 1
+#define LKR_ARITY_ONE_1 1
+#define LKR_ARITY_ONE_LKR_NONEMPTY 0
+
+/* M(arg, position, subr) for each argument. */
+#define LKR_EACH(M, subr, args) \
+  LKR_EACH_I(LKR_CAT(LKR_EACH_, LKR_ARITY(args)), M, subr, LKR_STRIP args)
+#define LKR_EACH_I(each, M, subr, ...) each(M, subr, __VA_ARGS__)
+#define LKR_EACH_0(M, subr, ...)
+#define LKR_EACH_1(M, subr, a) M(a, SCM_ARG1, subr)
+#define LKR_EACH_2(M, subr, a, b) LKR_EACH_1(M, subr, a) M(b, SCM_ARG2, subr)
+#define LKR_EACH_3(M, subr, a, b, c) LKR_EACH_2(M, subr, a, b) M(c, SCM_ARG3, subr)
+#define LKR_EACH_4(M, subr, a, b, c, d) LKR_EACH_3(M, subr, a, b, c) M(d, SCM_ARG4, subr)
+
+/* The C argument list. */
+#define LKR_PARAMS(args) LKR_CAT(LKR_PARAMS_, LKR_ARITY(args)) args
+#define LKR_PARAMS_0(...) (void)
+#define LKR_PARAMS_1(a) (SCM LKR_ARG_NAME a)
+#define LKR_PARAMS_2(a, b) (SCM LKR_ARG_NAME a, SCM LKR_ARG_NAME b)
+#define LKR_PARAMS_3(a, b, c) (SCM LKR_ARG_NAME a, SCM LKR_ARG_NAME b, SCM LKR_ARG_NAME c)
+#define LKR_PARAMS_4(a, b, c, d) \
+  (SCM LKR_ARG_NAME a, SCM LKR_ARG_NAME b, SCM LKR_ARG_NAME c, SCM LKR_ARG_NAME d)
+
+#define LKR_ARG_KIND(kind, name) kind
+#define LKR_ARG_NAME(kind, name) name
+
+/* Check an argument and convert it into req_<name>. */
+#define LKR_ARG(arg, pos, subr) LKR_ARG_I(LKR_ARG_KIND arg, LKR_ARG_NAME arg, pos, subr)
+#define LKR_ARG_I(kind, name, pos, subr) LKR_ARG_II(kind, name, pos, subr)
+#define LKR_ARG_II(kind, name, pos, subr)				\
+  SCM_ASSERT_TYPE(LKR_IS_##kind(name), name, pos, subr, LKR_DESC_##kind); \
+  LKR_TYPE_##kind req_##name = LKR_TO_##kind(name, subr);
+
+/* Pass req_<name> to keyctl. */
+#define LKR_CALL_ARG(arg, pos, subr) LKR_CALL_ARG_I(LKR_ARG_KIND arg, LKR_ARG_NAME arg)
+#define LKR_CALL_ARG_I(kind, name) LKR_CALL_ARG_II(kind, name)
+#define LKR_CALL_ARG_II(kind, name) , LKR_PASS_##kind(req_##name)
+
+/* + 1 for each argument that is staged. */
+#define LKR_STAGED_ARG(arg, pos, subr) LKR_STAGED_ARG_I(LKR_ARG_KIND arg)
+#define LKR_STAGED_ARG_I(kind) LKR_STAGED_ARG_II(kind)
+#define LKR_STAGED_ARG_II(kind) + LKR_STAGED_##kind
+
+#define LKR_IS_SERIAL(x) scm_is_key_serial_t(x)
+#define LKR_TYPE_SERIAL key_serial_t
+#define LKR_TO_SERIAL(x, subr) scm_to_key_serial_t(x)
+#define LKR_PASS_SERIAL(req) req
+#define LKR_STAGED_SERIAL 0
+#define LKR_DESC_SERIAL KEY_SERIAL_DESC
+
+#define LKR_IS_OPT_SERIAL(x) \
+  (scm_is_key_serial_t(x) || scm_is_false(x) || scm_is_undefined(x))
+#define LKR_TYPE_OPT_SERIAL key_serial_t
+#define LKR_TO_OPT_SERIAL(x, subr) (scm_is_key_serial_t(x) ? scm_to_key_serial_t(x) : 0)
+#define LKR_PASS_OPT_SERIAL(req) req
+#define LKR_STAGED_OPT_SERIAL 0
+#define LKR_DESC_OPT_SERIAL KEY_SERIAL_DESC OR_FALSE
+
+#define LKR_IS_OPT_BOOL(x) (scm_is_bool(x) || scm_is_undefined(x))
+#define LKR_TYPE_OPT_BOOL int
+#define LKR_TO_OPT_BOOL(x, subr) (scm_is_bool(x) && scm_to_bool(x))
+#define LKR_PASS_OPT_BOOL(req) req
+#define LKR_STAGED_OPT_BOOL 0
+#define LKR_DESC_OPT_BOOL BOOL_DESC
+
+#define LKR_IS_UINT(x) (SCM_I_INUMP(x) || scm_is_number(x))
+#define LKR_TYPE_UINT unsigned
+#define LKR_TO_UINT(x, subr) scm_to_lkr_unsigned(x)
+#define LKR_PASS_UINT(req) req
+#define LKR_STAGED_UINT 0
+#define LKR_DESC_UINT NUM_DESC
+
+#define LKR_IS_INT(x) \
+  (lkr_is_fixnum_in(x, INT_MIN, INT_MAX) || scm_is_signed_integer(x, INT_MIN, INT_MAX))
+#define LKR_TYPE_INT int
+#define LKR_TO_INT(x, subr) scm_to_lkr_int(x)
+#define LKR_PASS_INT(req) req
+#define LKR_STAGED_INT 0
+#define LKR_DESC_INT NUM_DESC
+
+#define LKR_IS_PERM(x) (SCM_I_INUMP(x) || scm_is_number(x))
+#define LKR_TYPE_PERM key_perm_t
+#define LKR_TO_PERM(x, subr) scm_to_lkr_perm(x)
+#define LKR_PASS_PERM(req) req
+#define LKR_STAGED_PERM 0
+#define LKR_DESC_PERM NUM_DESC
+
+#define LKR_IS_OPT_ID(x) (SCM_I_INUMP(x) || scm_is_number(x) || scm_is_false(x) || scm_is_undefined(x))
+#define LKR_TYPE_OPT_ID uid_t
+#define LKR_TO_OPT_ID(x, subr) ((uid_t)scm_to_lkr_id(x))
+#define LKR_PASS_OPT_ID(req) req
+#define LKR_STAGED_OPT_ID 0
+#define LKR_DESC_OPT_ID NUM_DESC OR_FALSE
+
+#define LKR_IS_STRING(x) scm_is_string(x)
+#define LKR_TYPE_STRING struct lkr_staged
+#define LKR_TO_STRING(x, subr) lkr_stage_arg(&req_stage, x, 1, subr)
+#define LKR_PASS_STRING(req) (req_stage.buf->data + (req).offset)
+#define LKR_STAGED_STRING 1
+#define LKR_DESC_STRING STRING_DESC
+
+#define LKR_IS_OPT_STRING(x) (scm_is_string(x) || scm_is_false(x) || scm_is_undefined(x))
+#define LKR_TYPE_OPT_STRING struct lkr_staged
+#define LKR_TO_OPT_STRING(x, subr) lkr_stage_arg(&req_stage, x, 1, subr)
+#define LKR_PASS_OPT_STRING(req) ((req).present ? req_stage.buf->data + (req).offset : NULL)
+#define LKR_STAGED_OPT_STRING 1
+#define LKR_DESC_OPT_STRING STRING_DESC OR_FALSE
+
+#define LKR_IS_PAYLOAD(x) scm_is_payload(x)
+#define LKR_TYPE_PAYLOAD struct lkr_staged
+#define LKR_TO_PAYLOAD(x, subr) lkr_stage_arg(&req_stage, x, 0, subr)
+#define LKR_PASS_PAYLOAD(req) (req_stage.buf->data + (req).offset), (req).len
+#define LKR_STAGED_PAYLOAD 1
+#define LKR_DESC_PAYLOAD PAYLOAD_DESC
+
+#define LKR_IS_OPT_PAYLOAD(x) (scm_is_payload(x) || scm_is_false(x) || scm_is_undefined(x))
+#define LKR_TYPE_OPT_PAYLOAD struct lkr_staged
+#define LKR_TO_OPT_PAYLOAD(x, subr) lkr_stage_arg(&req_stage, x, 0, subr)
+#define LKR_PASS_OPT_PAYLOAD(req) \
+  ((req).present ? req_stage.buf->data + (req).offset : NULL), (req).len
+#define LKR_STAGED_OPT_PAYLOAD 1
+#define LKR_DESC_OPT_PAYLOAD PAYLOAD_DESC OR_FALSE
+
+#define LKR_RESULT_SERIAL(result) scm_from_key_serial_t(result)
+#define LKR_RESULT_LONG(result) scm_from_long(result)
+#define LKR_RESULT_TRUE_IF_ZERO(result) ((result) ? scm_from_long(result) : SCM_BOOL_T)
+
+/* Wrappers that stage nothing need no dynwind context, and the
+   compiler drops the staging code from them. */
+#define LKR_KEYCTL_WRAPPER(op, sname, cname, doc, req, opt, res, changes, args) \
+  static const char s_##cname[] = sname;				\
+									\
+  static SCM								\
+  cname LKR_PARAMS(args)						\
+  {									\
+    const int staged = 0 LKR_EACH(LKR_STAGED_ARG, s_##cname, args);	\
+    struct lkr_stage req_stage = { NULL, 0 };				\
+    long result = 0;							\
+									\
+    lkr_stage_begin(&req_stage, staged);				\
+									\
+    LKR_EACH(LKR_ARG, s_##cname, args)					\
+									\
+    result = lkr_stat(LKR_STAT_##op,					\
+		      keyctl(KEYCTL_##op LKR_EACH(LKR_CALL_ARG, s_##cname, args))); \
+									\
+    if(staged)								\
+      {									\
+	scm_dynwind_end();						\
+      }									\
+									\
+    if(result < 0)							\
+      {									\
+	scm_syserror(s_##cname);					\
+      }									\
+									\
+    if(changes)								\
+      {									\
+	lkr_key_handles_changed();					\
+      }									\
+									\
+    return LKR_RESULT_##res(result);					\
+  }
 
-// long keyctl(KEYCTL_INVALIDATE, key_serial_t key);
-/* SCM */
-SCM_DEFINE (keyctl_invalidate_wrapper,   /* Function name in C */
-            "keyctl-invalidate", /* Function name in Scheme */
-            1, 0,      /* No. of required/optional args */
-            0,         /* Whether accepts "rest" arg */
-            (SCM key), /* C argument list */
-            "Invalidate a key.") /* Docstring */
-{
-  long result = 0;
-  key_serial_t req_key = 0;
-
-  SCM_ASSERT_TYPE(scm_is_key_serial_t(key), key, SCM_ARG1, s_keyctl_invalidate_wrapper, KEY_SERIAL_DESC );
-
-  req_key = scm_to_key_serial_t(key);
+LKR_KEYCTL_OPS(LKR_KEYCTL_WRAPPER)
 
-  result = keyctl(KEYCTL_INVALIDATE, req_key);
+/* scm_c_define_gsubr leaves the docstring out, so it is set as the
+   procedure's documentation property, where procedure-documentation
+   finds it. */
+#define LKR_KEYCTL_DEFINE(op, sname, cname, doc, req, opt, res, changes, args) \
+  scm_set_procedure_property_x(scm_c_define_gsubr(s_##cname, req, opt, 0,	\
+						  (SCM_FUNC_CAST_ARBITRARY_ARGS) cname), \
+			       sym_documentation, scm_from_utf8_string(doc));
 
-  if(result < 0)
-    {
-      scm_syserror(s_keyctl_invalidate_wrapper);
-    }
+SCM_SYMBOL(sym_documentation, "documentation");
 
-  return result ? scm_from_long(result) : SCM_BOOL_T;
-}
 
 
 /* ******************************************************************
@@ -970,6 +769,13 @@ init_linux_key_retention (void)
 
   #include "main.x"
 
+  LKR_KEYCTL_OPS(LKR_KEYCTL_DEFINE)
+
+  init_lkr_key_handle();
+  init_lkr_key_job();
+  init_lkr_stats();
+  init_lkr_codec();
+
 
   /* keyctl methods.
      Separated out to procedures 'cause that's probably a good idea.
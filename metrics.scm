@@ -0,0 +1,200 @@
+ ;; Copyright (C) 2016 Kirk Zurell.
+
+ ;; guile-linux-key-retention is free software; you can redistribute
+ ;; it and/or modify it under the terms of the GNU Lesser General
+ ;; Public License as published by the Free Software Foundation;
+ ;; either version 3 of the License, or (at your option) any later
+ ;; version.
+
+ ;; This library is distributed in the hope that it will be useful, but
+ ;; WITHOUT ANY WARRANTY; without even the implied warranty of
+ ;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ ;; Lesser General Public License for more details.
+
+ ;; You should have received a copy of the GNU Lesser General Public
+ ;; License along with this library; if not, write to the Free Software
+ ;; Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ ;; 02110-1301 USA
+
+;;; Binding and keyring metrics, as OpenMetrics text.
+;;;
+;;; The counters come from key-retention-stats, which sums per-thread
+;;; counters without stopping the threads that update them; the quotas
+;;; come from /proc/key-users. A snapshot makes no key calls at all.
+
+(define-module (linux-key-retention metrics)
+  #:use-module (ice-9 rdelim)
+  #:use-module (ice-9 regex)
+  #:use-module (ice-9 threads)
+  #:use-module (rnrs bytevectors)
+  #:use-module (linux-key-retention guile-linux-key-retention)
+  #:export (key-users
+            write-metrics
+            write-metrics-file
+            serve-metrics))
+
+(define %key-users-file "/proc/key-users")
+
+;; "  1000:     5 5/5 3/200 54/20000"
+(define key-users-line
+  (make-regexp "^ *([0-9]+): +([0-9]+) ([0-9]+)/([0-9]+) ([0-9]+)/([0-9]+) ([0-9]+)/([0-9]+)"))
+
+(define (key-users)
+  "Return the per-UID key quota usage in /proc/key-users, as a list of
+alists, or '() where it cannot be read."
+  (catch 'system-error
+    (lambda ()
+      (call-with-input-file %key-users-file
+        (lambda (port)
+          (let loop ((line (read-line port)) (users '()))
+            (if (eof-object? line)
+                (reverse users)
+                (loop (read-line port)
+                      (let ((m (regexp-exec key-users-line line)))
+                        (if m
+                            (let ((field (lambda (n)
+                                           (string->number (match:substring m n)))))
+                              (cons `((uid . ,(field 1))
+                                      (usage . ,(field 2))
+                                      (keys . ,(field 5))
+                                      (max-keys . ,(field 6))
+                                      (bytes . ,(field 7))
+                                      (max-bytes . ,(field 8)))
+                                    users))
+                            users))))))))
+    (lambda _
+      '())))
+
+(define (family port name type help)
+  (format port "# TYPE ~a ~a~%# HELP ~a ~a~%" name type name help))
+
+(define (le bound)
+  (if (eq? bound #t) "+Inf" (number->string bound)))
+
+(define* (write-metrics #:optional (port (current-output-port)))
+  "Write a snapshot of the metrics to PORT, as OpenMetrics text."
+  (let ((stats (key-retention-stats))
+        (users (key-users)))
+    (family port "lkr_calls" "counter" "Calls made through the bindings.")
+    (for-each (lambda (op)
+                (format port "lkr_calls_total{op=~s} ~a~%" (car op) (cadr op)))
+              (assq-ref stats 'calls))
+
+    (family port "lkr_errors" "counter" "Calls that failed.")
+    (for-each (lambda (op)
+                (format port "lkr_errors_total{op=~s} ~a~%" (car op) (caddr op)))
+              (assq-ref stats 'calls))
+
+    (let ((buckets (assq-ref stats 'request-key-buckets)))
+      (family port "lkr_request_key_seconds" "histogram"
+              "Time request-key took, including any upcall.")
+      (for-each (lambda (bucket)
+                  (format port "lkr_request_key_seconds_bucket{le=~s} ~a~%"
+                          (le (car bucket)) (cdr bucket)))
+                buckets)
+      (format port "lkr_request_key_seconds_count ~a~%" (cdr (last-pair buckets)))
+      (format port "lkr_request_key_seconds_sum ~a~%"
+              (assq-ref stats 'request-key-seconds)))
+
+    (family port "lkr_key_handle_cache_hits" "counter"
+            "Key handle lookups answered from the cache.")
+    (format port "lkr_key_handle_cache_hits_total ~a~%"
+            (assq-ref stats 'key-handle-cache-hits))
+    (family port "lkr_key_handle_cache_misses" "counter"
+            "Key handle lookups that made a key call.")
+    (format port "lkr_key_handle_cache_misses_total ~a~%"
+            (assq-ref stats 'key-handle-cache-misses))
+
+    (for-each (lambda (metric)
+                (let ((name (car metric)) (field (cadr metric)))
+                  (family port name "gauge" (caddr metric))
+                  (for-each (lambda (user)
+                              (format port "~a{uid=\"~a\"} ~a~%"
+                                      name (assq-ref user 'uid)
+                                      (assq-ref user field)))
+                            users)))
+              '(("lkr_key_users_keys" keys "Keys owned by the user.")
+                ("lkr_key_users_max_keys" max-keys "The user's key quota.")
+                ("lkr_key_users_bytes" bytes "Payload bytes owned by the user.")
+                ("lkr_key_users_max_bytes" max-bytes "The user's byte quota.")))
+
+    (display "# EOF\n" port)))
+
+(define (write-metrics-file file)
+  "Write a snapshot of the metrics to FILE, replacing it atomically, as
+the node exporter textfile collector expects."
+  (let* ((tmp (string-append file ".tmp"))
+         (port (open-output-file tmp)))
+    (write-metrics port)
+    (force-output port)
+    (fsync port)
+    (close-port port)
+    (rename-file tmp file)))
+
+;; Seconds a client has to finish sending its request.
+(define %request-timeout 5)
+
+(define (skip-request port)
+  ;; Up to the blank line that ends an HTTP request's headers, or EOF
+  ;; for a client that just connects and reads. Returns #f for a client
+  ;; that sends neither in time, so that it cannot hold up the others.
+  (let ((deadline (+ (current-time) %request-timeout)))
+    (let loop ((blank? #t))
+      (let ((left (- deadline (current-time))))
+        (and (> left 0)
+             (pair? (car (select (list port) '() '() left)))
+             (let ((c (read-char port)))
+               (cond ((eof-object? c) #t)
+                     ((eqv? c #\newline) (or blank? (loop #t)))
+                     ((eqv? c #\return) (loop blank?))
+                     (else (loop #f)))))))))
+
+;; Sends fail with EPIPE rather than raising SIGPIPE, whatever the
+;; process does with the signal. Linux's value, where Guile does not
+;; define it.
+(define %msg-nosignal
+  (if (defined? 'MSG_NOSIGNAL) MSG_NOSIGNAL #x4000))
+
+(define (send-all sock bv)
+  (let ((len (bytevector-length bv)))
+    (let loop ((start 0))
+      (when (< start len)
+        (loop (+ start
+                 (send sock
+                       (if (zero? start)
+                           bv
+                           (let ((rest (make-bytevector (- len start))))
+                             (bytevector-copy! bv start rest 0 (- len start))
+                             rest))
+                       %msg-nosignal)))))))
+
+(define (serve-client client)
+  ;; Unbuffered, so that select in skip-request sees everything the
+  ;; client has sent.
+  (setvbuf client (cond-expand (guile-2.2 'none) (else _IONBF)))
+  (catch 'system-error
+    (lambda ()
+      (when (skip-request client)
+        (send-all client
+                  (string->utf8
+                   (string-append
+                    "HTTP/1.0 200 OK\r\n"
+                    "Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n\r\n"
+                    (call-with-output-string write-metrics))))))
+    (lambda _
+      #f))
+  (close-port client))
+
+(define (serve-metrics file)
+  "Serve a fresh snapshot of the metrics over HTTP to each client of the
+Unix socket FILE, as for \"curl --unix-socket FILE http://localhost/\",
+each on a thread of its own. Does not return."
+  (let ((server (socket PF_UNIX SOCK_STREAM 0)))
+    (when (file-exists? file)
+      (delete-file file))
+    (bind server AF_UNIX file)
+    (listen server 8)
+    (let loop ()
+      (let ((client (car (accept server))))
+        (call-with-new-thread (lambda () (serve-client client))))
+      (loop))))
@@ -0,0 +1,181 @@
+/* Copyright (C) 2016 Kirk Zurell.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/* guile-linux-key-retention: worker threads for blocking key calls.
+
+   Each pool is a fixed set of detached threads taking jobs from one
+   FIFO queue. The threads never enter Guile mode, so a job blocked in
+   the kernel, for instance on a request-key upcall, holds up neither
+   the garbage collector nor the thread that submitted it.
+*/
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "pool.h"
+
+struct lkr_pool
+{
+  const char *variable; /* Overrides threads. */
+  int threads;
+
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+
+  struct lkr_job *head;
+  struct lkr_job *tail;
+
+  int workers;
+};
+
+static struct lkr_pool pools[LKR_POOL_N] =
+  {
+    [LKR_POOL_KEY_JOBS] = { "GUILE_LKR_POOL_THREADS", LKR_POOL_THREADS,
+			    PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER },
+    [LKR_POOL_SEARCH] = { "GUILE_LKR_SEARCH_THREADS", LKR_SEARCH_THREADS,
+			  PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER }
+  };
+
+static pthread_once_t atfork_once = PTHREAD_ONCE_INIT;
+
+/* A forked child has none of the parent's threads, so it starts its
+   own, and the parent's queued jobs are not its to run. */
+static void
+reset_in_child(void)
+{
+  struct lkr_pool *pool;
+
+  for(pool = pools; pool < pools + LKR_POOL_N; pool++)
+    {
+      pthread_mutex_init(&pool->lock, NULL);
+      pthread_cond_init(&pool->ready, NULL);
+      pool->head = NULL;
+      pool->tail = NULL;
+      pool->workers = 0;
+    }
+}
+
+static void
+register_atfork(void)
+{
+  pthread_atfork(NULL, NULL, reset_in_child);
+}
+
+static void *
+worker(void *p)
+{
+  struct lkr_pool *pool = p;
+  struct lkr_job *job;
+
+  for(;;)
+    {
+      pthread_mutex_lock(&pool->lock);
+
+      while(pool->head == NULL)
+	{
+	  pthread_cond_wait(&pool->ready, &pool->lock);
+	}
+
+      job = pool->head;
+      pool->head = job->next;
+
+      if(pool->head == NULL)
+	{
+	  pool->tail = NULL;
+	}
+
+      pthread_mutex_unlock(&pool->lock);
+
+      job->next = NULL;
+      job->run(job);
+      job->done(job);
+    }
+
+  return NULL;
+}
+
+/* Called with pool->lock held. */
+static int
+start_workers(struct lkr_pool *pool)
+{
+  const char *value = getenv(pool->variable);
+  int wanted = value ? atoi(value) : pool->threads;
+  pthread_attr_t attr;
+  pthread_t thread;
+  int error = 0;
+
+  if(wanted < 1)
+    {
+      wanted = 1;
+    }
+
+  pthread_once(&atfork_once, register_atfork);
+
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+  while(pool->workers < wanted
+	&& (error = pthread_create(&thread, &attr, worker, pool)) == 0)
+    {
+      pool->workers++;
+    }
+
+  pthread_attr_destroy(&attr);
+
+  /* Fewer workers than asked for will still do. */
+  if(pool->workers == 0)
+    {
+      errno = error;
+      return -1;
+    }
+
+  return 0;
+}
+
+int
+lkr_pool_submit(enum lkr_pool_id id, struct lkr_job *job)
+{
+  struct lkr_pool *pool = &pools[id];
+
+  pthread_mutex_lock(&pool->lock);
+
+  if(pool->workers == 0 && start_workers(pool) < 0)
+    {
+      pthread_mutex_unlock(&pool->lock);
+      return -1;
+    }
+
+  job->next = NULL;
+
+  if(pool->tail)
+    {
+      pool->tail->next = job;
+    }
+  else
+    {
+      pool->head = job;
+    }
+
+  pool->tail = job;
+
+  pthread_cond_signal(&pool->ready);
+  pthread_mutex_unlock(&pool->lock);
+
+  return 0;
+}
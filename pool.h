@@ -0,0 +1,55 @@
+/* Copyright (C) 2016 Kirk Zurell.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/* guile-linux-key-retention: worker threads for blocking key calls. */
+
+#ifndef GUILE_LKR_POOL_H
+#define GUILE_LKR_POOL_H
+
+/* Workers started unless GUILE_LKR_POOL_THREADS says otherwise. */
+#define LKR_POOL_THREADS 4
+
+/* Workers started unless GUILE_LKR_SEARCH_THREADS says otherwise. */
+#define LKR_SEARCH_THREADS 4
+
+/* Each pool has workers and a queue of its own, so that jobs in one
+   never wait behind jobs in another. */
+enum lkr_pool_id
+  {
+    LKR_POOL_KEY_JOBS, /* Key jobs, which may block on an upcall. */
+    LKR_POOL_SEARCH,   /* keyctl-search-any tiers, which do not. */
+    LKR_POOL_N
+  };
+
+/* A unit of work. Callers embed it in their own structure.
+
+   Both callbacks run on a worker thread that is not in Guile mode, so
+   they must not touch SCM values. done is called once run returns,
+   and may free the job. */
+struct lkr_job
+{
+  void (*run)(struct lkr_job *job);
+  void (*done)(struct lkr_job *job);
+  struct lkr_job *next; /* Owned by the pool. */
+};
+
+/* Queues job in pool, starting its workers on first use. Returns 0,
+   or -1 with errno set if no worker could be started. */
+int lkr_pool_submit(enum lkr_pool_id pool, struct lkr_job *job);
+
+#endif /* GUILE_LKR_POOL_H */
@@ -0,0 +1,310 @@
+/* Copyright (C) 2016 Kirk Zurell.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/* guile-linux-key-retention: call counters for the metrics module.
+
+   Each thread counts into its own block, so the wrappers never share a
+   cache line or take a lock. A snapshot sums the live blocks, plus the
+   totals left by threads that have exited, under the lock that guards
+   the list of blocks. Counters are only written by their own thread,
+   with relaxed atomic stores so that a snapshot never reads a torn
+   value.
+*/
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <libguile.h>
+
+#include "stats.h"
+
+/* Upper bounds of the request-key latency buckets, in nanoseconds.
+   Upcalls run from a fraction of a millisecond, for a cached key, to
+   seconds. */
+static const long long request_key_bounds[] = {
+  100000LL, 500000LL, 1000000LL, 5000000LL, 10000000LL, 50000000LL,
+  100000000LL, 500000000LL, 1000000000LL, 5000000000LL, 10000000000LL,
+};
+
+#define N_BOUNDS (sizeof(request_key_bounds) / sizeof(request_key_bounds[0]))
+
+struct lkr_thread_stats
+{
+  unsigned long calls[LKR_STAT_N];
+  unsigned long errors[LKR_STAT_N];
+  unsigned long request_key[N_BOUNDS + 1]; /* The last is +Inf. */
+  unsigned long long request_key_ns;
+  unsigned long cache_hits;
+  unsigned long cache_misses;
+
+  struct lkr_thread_stats *next;
+};
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t stats_key;
+static pthread_once_t stats_once = PTHREAD_ONCE_INIT;
+
+static struct lkr_thread_stats *live;
+static struct lkr_thread_stats retired;
+
+static __thread struct lkr_thread_stats *mine;
+
+static const char *stat_names[] = {
+#define LKR_STAT_NAME(...) LKR_STAT_NAME_I(__VA_ARGS__, _)
+#define LKR_STAT_NAME_I(op, name, ...) name,
+  LKR_STAT_OPS(LKR_STAT_NAME)
+#undef LKR_STAT_NAME
+#undef LKR_STAT_NAME_I
+};
+
+#define BUMP(counter) \
+  __atomic_store_n(&(counter), (counter) + 1, __ATOMIC_RELAXED)
+
+#define READ(counter) __atomic_load_n(&(counter), __ATOMIC_RELAXED)
+
+
+
+/* ******************************************************************
+   Per-thread blocks
+*/
+
+static void
+add_stats(struct lkr_thread_stats *total, struct lkr_thread_stats *s)
+{
+  size_t i;
+
+  for(i = 0; i < LKR_STAT_N; i++)
+    {
+      total->calls[i] += READ(s->calls[i]);
+      total->errors[i] += READ(s->errors[i]);
+    }
+
+  for(i = 0; i < N_BOUNDS + 1; i++)
+    {
+      total->request_key[i] += READ(s->request_key[i]);
+    }
+
+  total->request_key_ns += READ(s->request_key_ns);
+  total->cache_hits += READ(s->cache_hits);
+  total->cache_misses += READ(s->cache_misses);
+}
+
+/* A thread's counts outlive it, in the retired totals. */
+static void
+retire(void *p)
+{
+  struct lkr_thread_stats *s = p;
+  struct lkr_thread_stats **pp;
+
+  pthread_mutex_lock(&stats_lock);
+
+  for(pp = &live; *pp; pp = &(*pp)->next)
+    {
+      if(*pp == s)
+	{
+	  *pp = s->next;
+	  break;
+	}
+    }
+
+  add_stats(&retired, s);
+
+  pthread_mutex_unlock(&stats_lock);
+
+  /* Destructors run on the exiting thread, which may still make calls
+     from a later one: those start a new block. */
+  mine = NULL;
+
+  free(s);
+}
+
+static void
+stats_init(void)
+{
+  pthread_key_create(&stats_key, retire);
+}
+
+/* This thread's block, or NULL if none could be allocated, in which
+   case the call goes uncounted. */
+static struct lkr_thread_stats *
+my_stats(void)
+{
+  int saved_errno = 0;
+
+  if(mine)
+    {
+      return mine;
+    }
+
+  saved_errno = errno;
+
+  pthread_once(&stats_once, stats_init);
+
+  if((mine = calloc(1, sizeof(*mine))) != NULL)
+    {
+      pthread_setspecific(stats_key, mine);
+
+      pthread_mutex_lock(&stats_lock);
+      mine->next = live;
+      live = mine;
+      pthread_mutex_unlock(&stats_lock);
+    }
+
+  errno = saved_errno;
+
+  return mine;
+}
+
+long
+lkr_stat(enum lkr_stat_op op, long result)
+{
+  struct lkr_thread_stats *s = my_stats();
+
+  if(s)
+    {
+      BUMP(s->calls[op]);
+
+      if(result < 0)
+	{
+	  BUMP(s->errors[op]);
+	}
+    }
+
+  return result;
+}
+
+void
+lkr_stat_request_key_ns(long long ns)
+{
+  struct lkr_thread_stats *s = my_stats();
+  size_t i;
+
+  if(s == NULL)
+    {
+      return;
+    }
+
+  for(i = 0; i < N_BOUNDS && ns > request_key_bounds[i]; i++)
+    ;
+
+  BUMP(s->request_key[i]);
+  __atomic_store_n(&s->request_key_ns, s->request_key_ns + ns, __ATOMIC_RELAXED);
+}
+
+void
+lkr_stat_cache(int hit)
+{
+  struct lkr_thread_stats *s = my_stats();
+
+  if(s)
+    {
+      if(hit)
+	{
+	  BUMP(s->cache_hits);
+	}
+      else
+	{
+	  BUMP(s->cache_misses);
+	}
+    }
+}
+
+long long
+lkr_stat_now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+
+/* ******************************************************************
+   Methods
+*/
+
+SCM_DEFINE (key_retention_stats,   /* Function name in C */
+            "key-retention-stats", /* Function name in Scheme */
+            0, 0,      /* No. of required/optional args */
+            0,         /* Whether accepts "rest" arg */
+            (void), /* C argument list */
+            "A snapshot of the call counters, as an alist.") /* Docstring */
+{
+  struct lkr_thread_stats total = { { 0 } };
+  struct lkr_thread_stats *s;
+  SCM calls = SCM_EOL;
+  SCM buckets = SCM_EOL;
+  unsigned long count = 0;
+  size_t i;
+
+  /* Sum under the lock, but allocate after it. */
+  pthread_mutex_lock(&stats_lock);
+
+  add_stats(&total, &retired);
+
+  for(s = live; s; s = s->next)
+    {
+      add_stats(&total, s);
+    }
+
+  pthread_mutex_unlock(&stats_lock);
+
+  for(i = LKR_STAT_N; i-- > 0; )
+    {
+      calls = scm_cons(scm_list_3(scm_from_locale_string(stat_names[i]),
+				  scm_from_ulong(total.calls[i]),
+				  scm_from_ulong(total.errors[i])),
+		       calls);
+    }
+
+  /* Cumulative, as histograms are exposed. */
+  for(i = 0; i < N_BOUNDS + 1; i++)
+    {
+      count += total.request_key[i];
+      buckets = scm_cons(scm_cons(i < N_BOUNDS
+				  ? scm_from_double(request_key_bounds[i] / 1e9)
+				  : SCM_BOOL_T,
+				  scm_from_ulong(count)),
+			 buckets);
+    }
+
+  return scm_list_5(scm_cons(scm_from_latin1_symbol("calls"), calls),
+		    scm_cons(scm_from_latin1_symbol("request-key-buckets"),
+			     scm_reverse_x(buckets, SCM_EOL)),
+		    scm_cons(scm_from_latin1_symbol("request-key-seconds"),
+			     scm_from_double(total.request_key_ns / 1e9)),
+		    scm_cons(scm_from_latin1_symbol("key-handle-cache-hits"),
+			     scm_from_ulong(total.cache_hits)),
+		    scm_cons(scm_from_latin1_symbol("key-handle-cache-misses"),
+			     scm_from_ulong(total.cache_misses)));
+}
+
+
+/* ******************************************************************
+   Initialization
+*/
+
+void
+init_lkr_stats(void)
+{
+  #include "stats.x"
+}
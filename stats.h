@@ -0,0 +1,67 @@
+/* Copyright (C) 2016 Kirk Zurell.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/* guile-linux-key-retention: call counters for the metrics module. */
+
+#ifndef GUILE_LKR_STATS_H
+#define GUILE_LKR_STATS_H
+
+#include "keyctl.h"
+
+/* The counted calls: C name and the wrapper's Scheme name, then the
+   keyctl operations generated from keyctl.h. */
+#define LKR_STAT_OPS(X)						\
+  X(ADD_KEY, "add-key")						\
+  X(REQUEST_KEY, "request-key")					\
+  X(DESCRIBE, "keyctl-describe")				\
+  X(SEARCH_ANY, "keyctl-search-any")				\
+  X(READ, "keyctl-read")					\
+  X(READ_BYTEVECTOR, "keyctl-read-bytevector")		\
+  X(GET_SECURITY, "keyctl-get-security")			\
+  LKR_KEYCTL_OPS(X)
+
+/* Hand entries have no more than op and name, so the rest of a
+   keyctl.h line is taken as one trailing argument or none. */
+#define LKR_STAT_ENUM(...) LKR_STAT_ENUM_I(__VA_ARGS__, _)
+#define LKR_STAT_ENUM_I(op, name, ...) LKR_STAT_##op,
+
+enum lkr_stat_op
+  {
+    LKR_STAT_OPS(LKR_STAT_ENUM)
+    LKR_STAT_N
+  };
+
+/* Counts one call of op, failed if result is negative, and returns
+   result. errno is preserved, so it can wrap the call itself:
+
+     result = lkr_stat(LKR_STAT_READ, keyctl(KEYCTL_READ, ...));
+*/
+long lkr_stat(enum lkr_stat_op op, long result);
+
+/* Records how long a request_key call took. */
+void lkr_stat_request_key_ns(long long ns);
+
+/* Counts a key handle cache lookup. */
+void lkr_stat_cache(int hit);
+
+/* CLOCK_MONOTONIC, in nanoseconds. */
+long long lkr_stat_now_ns(void);
+
+void init_lkr_stats(void);
+
+#endif /* GUILE_LKR_STATS_H */
@@ -0,0 +1,54 @@
+ ;; Copyright (C) 2016 Kirk Zurell.
+
+ ;; guile-linux-key-retention is free software; you can redistribute
+ ;; it and/or modify it under the terms of the GNU Lesser General
+ ;; Public License as published by the Free Software Foundation;
+ ;; either version 3 of the License, or (at your option) any later
+ ;; version.
+
+ ;; This library is distributed in the hope that it will be useful, but
+ ;; WITHOUT ANY WARRANTY; without even the implied warranty of
+ ;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ ;; Lesser General Public License for more details.
+
+ ;; You should have received a copy of the GNU Lesser General Public
+ ;; License along with this library; if not, write to the Free Software
+ ;; Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ ;; 02110-1301 USA
+
+;;; Loads the uninstalled extension and calls a few wrappers, for
+;;; "make check". Kernels and containers that refuse key calls are
+;;; fine: the wrapper must still raise a system-error, rather than
+;;; fail to load or to find a procedure.
+
+(use-modules (rnrs bytevectors)
+             (linux-key-retention guile-linux-key-retention))
+
+(define failures 0)
+
+(define (check name ok?)
+  (unless ok?
+    (format (current-error-port) "smoke.scm: ~a failed~%" name)
+    (set! failures (1+ failures))))
+
+;; The result of thunk, or the key of the exception it raised.
+(define (outcome thunk)
+  (catch #t thunk (lambda (key . args) key)))
+
+(check "keyctl-get-keyring-id"
+       (let ((result (outcome (lambda ()
+                                (keyctl-get-keyring-id KEY_SPEC_PROCESS_KEYRING #t)))))
+         (or (and (integer? result) (> result 0))
+             (eq? result 'system-error))))
+
+(check "keyctl-get-keyring-id argument check"
+       (eq? (outcome (lambda ()
+                       (keyctl-get-keyring-id "not a keyring" #t)))
+            'wrong-type-arg))
+
+(check "key-record round trip"
+       (let ((record `((name . "smoke") (n . -1) (bytes . ,(make-bytevector 3 7)))))
+         (equal? (bytevector->key-record (key-record->bytevector record))
+                 record)))
+
+(exit (zero? failures))
@@ -0,0 +1,239 @@
+ ;; Copyright (C) 2016 Kirk Zurell.
+
+ ;; guile-linux-key-retention is free software; you can redistribute
+ ;; it and/or modify it under the terms of the GNU Lesser General
+ ;; Public License as published by the Free Software Foundation;
+ ;; either version 3 of the License, or (at your option) any later
+ ;; version.
+
+ ;; This library is distributed in the hope that it will be useful, but
+ ;; WITHOUT ANY WARRANTY; without even the implied warranty of
+ ;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ ;; Lesser General Public License for more details.
+
+ ;; You should have received a copy of the GNU Lesser General Public
+ ;; License along with this library; if not, write to the Free Software
+ ;; Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ ;; 02110-1301 USA
+
+;;; Dispatch request-key upcalls to Scheme handlers.
+;;;
+;;; Handlers are registered against a key type and a description
+;;; pattern, and kept in one prefix trie per key type. Finding the
+;;; handler for an upcall walks the description once, so its cost
+;;; does not grow with the number of handlers registered.
+
+(define-module (linux-key-retention upcall)
+  #:use-module (srfi srfi-9)
+  #:use-module (rnrs bytevectors)
+  ;; Only loaded to compile providers, not on every upcall.
+  #:autoload (system base compile) (compile-file)
+  #:use-module (linux-key-retention guile-linux-key-retention)
+  #:export (make-upcall
+            upcall?
+            upcall-key
+            upcall-type
+            upcall-description
+            upcall-callout-info
+            upcall-callout-record
+            upcall-session-keyring
+
+            register-upcall-handler!
+            find-upcall-handler
+            upcall-negative-timeout
+            command-line->upcall
+            upcall-dispatch
+            load-upcall-providers
+            compile-upcall-providers
+            upcall-main))
+
+(define-record-type <upcall>
+  (make-upcall key type description callout-info session-keyring)
+  upcall?
+  (key upcall-key)
+  (type upcall-type)
+  (description upcall-description)
+  (callout-info upcall-callout-info)
+  (session-keyring upcall-session-keyring))
+
+(define (upcall-callout-record upcall)
+  "The callout information of UPCALL, decoded as a key record made by
+key-record->callout-info."
+  (callout-info->key-record (upcall-callout-info upcall)))
+
+;; Seconds a negated or rejected key stays negative.
+(define upcall-negative-timeout (make-parameter 30))
+
+(define %upcall-provider-directory
+  (or (getenv "GUILE_LKR_PROVIDERS") "/etc/guile-lkr.d"))
+
+
+
+;;; Prefix tries.
+;;;
+;;; A node is #(PREFIX-HANDLER EXACT-HANDLER CHILDREN): PREFIX-HANDLER
+;;; matches any description that starts with the path to the node,
+;;; EXACT-HANDLER only the description that ends there, and CHILDREN
+;;; maps the next character to a node.
+
+(define (make-trie-node)
+  (vector #f #f (make-hash-table)))
+
+;; key type -> root node. "*" holds handlers for any key type.
+(define %upcall-tries (make-hash-table))
+
+(define (register-upcall-handler! type pattern handler)
+  "Call HANDLER for upcalls on keys of TYPE whose description matches
+PATTERN. A PATTERN ending in \"*\" matches every description with that
+prefix, otherwise it matches exactly. TYPE \"*\" matches any key type.
+
+The longest matching pattern wins, and an exact match beats a prefix
+match of the same length."
+  (let* ((len (string-length pattern))
+         (wild? (and (> len 0) (char=? (string-ref pattern (1- len)) #\*)))
+         (prefix (if wild? (substring pattern 0 (1- len)) pattern))
+         (root (or (hash-ref %upcall-tries type)
+                   (let ((node (make-trie-node)))
+                     (hash-set! %upcall-tries type node)
+                     node))))
+    (let loop ((node root) (i 0))
+      (if (= i (string-length prefix))
+          (vector-set! node (if wild? 0 1) handler)
+          (let* ((children (vector-ref node 2))
+                 (c (string-ref prefix i)))
+            (loop (or (hashv-ref children c)
+                      (let ((child (make-trie-node)))
+                        (hashv-set! children c child)
+                        child))
+                  (1+ i)))))))
+
+(define (trie-lookup root description)
+  (let ((len (string-length description)))
+    (let loop ((node root) (i 0) (best #f))
+      (let ((best (or (vector-ref node 0) best)))
+        (if (= i len)
+            (or (vector-ref node 1) best)
+            (let ((next (hashv-ref (vector-ref node 2)
+                                   (string-ref description i))))
+              (if next
+                  (loop next (1+ i) best)
+                  best)))))))
+
+(define (find-upcall-handler type description)
+  "Return the handler registered for TYPE and DESCRIPTION, or #f."
+  (define (lookup type)
+    (let ((root (hash-ref %upcall-tries type)))
+      (and root (trie-lookup root description))))
+  (or (lookup type) (lookup "*")))
+
+
+
+;;; Upcalls.
+
+(define (key-type key)
+  ;; keyctl-describe returns "type;uid;gid;perm;description".
+  (let ((description (keyctl-describe key)))
+    (substring description 0 (string-index description #\;))))
+
+(define (command-line->upcall args)
+  "Parse the request-key arguments \"%k %t %d %c %S\". The key type may
+be omitted (\"%k %d %c %S\"), at the cost of one keyctl-describe."
+  (define (serial s)
+    (or (string->number s)
+        (error "Not a key serial:" s)))
+  (case (length args)
+    ((5)
+     (apply (lambda (key type description callout-info session)
+              (make-upcall (serial key) type description callout-info
+                           (serial session)))
+            args))
+    ((4)
+     (apply (lambda (key description callout-info session)
+              (let ((key (serial key)))
+                (make-upcall key (key-type key) description callout-info
+                             (serial session))))
+            args))
+    (else
+     (error "Usage: guile-lkr-upcall KEY [TYPE] DESCRIPTION CALLOUT-INFO SESSION-KEYRING"))))
+
+(define (upcall-finish upcall result)
+  ;; A handler returns a payload to instantiate the key with, an errno
+  ;; to reject it with, #t if it has dealt with the key itself, or #f
+  ;; to negate it.
+  (let ((key (upcall-key upcall)))
+    (cond ((eq? result #t) #t)
+          ((or (string? result) (bytevector? result))
+           (keyctl-instantiate key result))
+          ((integer? result)
+           (keyctl-reject key (upcall-negative-timeout) result))
+          (else
+           (keyctl-negate key (upcall-negative-timeout))))))
+
+(define (upcall-dispatch upcall)
+  "Run the handler for UPCALL and finish the key with its result. Keys
+without a handler, or whose handler throws, are negated."
+  (let ((handler (find-upcall-handler (upcall-type upcall)
+                                      (upcall-description upcall))))
+    (upcall-finish
+     upcall
+     (and handler
+          (catch #t
+            (lambda ()
+              (handler upcall))
+            (lambda (tag . args)
+              (format (current-error-port)
+                      "guile-lkr-upcall: ~a ~s: ~s ~s~%"
+                      (upcall-type upcall) (upcall-description upcall)
+                      tag args)
+              #f))))))
+
+(define (provider-files directory)
+  ;; The \".scm\" files in DIRECTORY, in name order.
+  (if (file-exists? directory)
+      (let ((dir (opendir directory)))
+        (let loop ((names '()))
+          (let ((name (readdir dir)))
+            (if (eof-object? name)
+                (begin
+                  (closedir dir)
+                  (map (lambda (name)
+                         (string-append directory "/" name))
+                       (sort names string<?)))
+                (loop (if (string-suffix? ".scm" name)
+                          (cons name names)
+                          names))))))
+      '()))
+
+(define (provider-compiled-file source)
+  (string-append (string-drop-right source 4) ".go"))
+
+(define (load-provider source)
+  ;; A compiled provider saves reading and compiling the source on
+  ;; every upcall, but only if it is not older than the source.
+  (let ((compiled (provider-compiled-file source)))
+    (if (and (file-exists? compiled)
+             (>= (stat:mtime (stat compiled)) (stat:mtime (stat source))))
+        (load-compiled compiled)
+        (load source))))
+
+(define (load-upcall-providers directory)
+  "Load every \".scm\" file in DIRECTORY, in name order, from the
+\".go\" file beside it where that is up to date. Missing directories
+are ignored."
+  (for-each load-provider (provider-files directory)))
+
+(define (compile-upcall-providers directory)
+  "Compile every \".scm\" file in DIRECTORY to a \".go\" file beside
+it, for load-upcall-providers. Run when providers are installed."
+  (for-each (lambda (source)
+              (compile-file source
+                            #:output-file (provider-compiled-file source)))
+            (provider-files directory)))
+
+(define* (upcall-main args #:key (providers %upcall-provider-directory))
+  "Entry point for request-key: load the providers, parse ARGS and
+dispatch the upcall."
+  (load-upcall-providers providers)
+  (let ((upcall (command-line->upcall args)))
+    (keyctl-assume-authority (upcall-key upcall))
+    (upcall-dispatch upcall)))